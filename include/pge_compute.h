@@ -0,0 +1,200 @@
+#ifndef PGE_COMPUTE_H
+#define PGE_COMPUTE_H
+
+#include "pge_pipeline.h"
+
+namespace pge
+{
+
+/* A compute pipeline, made from a single shader and the layouts, like the
+DrawPipeline it goes through the window's pipeline cache and the registry's
+shader modules. The commands can be recorded for the compute queue of the
+window or for the graphic one, both support compute. */
+struct ComputePipeline {
+    shader_info_t _shader_info;
+    layouts_info_t _layouts_info;
+
+    PgeWindow *window = nullptr;
+    PipelineRegistry *registry = nullptr;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+    std::vector<VkPushConstantRange> push_ranges;
+
+    /* from the shader, {0, 0, 0} if it isn't known (see dispatch_items) */
+    uint32_t local_size[3] = { 0, 0, 0 };
+
+    ComputePipeline(PgeWindow *window, PipelineRegistry *registry = nullptr)
+    : window(window), registry(registry) {}
+
+    ComputePipeline(const ComputePipeline&) = delete;
+    ComputePipeline& operator = (const ComputePipeline&) = delete;
+
+    void create_pipeline(shader_info_t shader_info,
+            layouts_info_t layouts_info = { .use_defaults = true })
+    {
+        if (pipeline)
+            EXCEPTION("The compute pipeline was already created");
+        if (layouts_info.use_defaults)
+            layouts_info = layouts_info_t{};
+        _shader_info = shader_info;
+        _layouts_info = layouts_info;
+        load_shader(_shader_info, SHC_COMPUTE_SHADER);
+        if (!_shader_info.get_code_size())
+            EXCEPTION("Failed to load shader %s", _shader_info.path.size() ?
+                    _shader_info.path : _shader_info.name);
+
+        auto code = _shader_info.get_code();
+        auto word_cnt = _shader_info.get_code_size() / sizeof(uint32_t);
+        if (!spirv_reflect_local_size(code, word_cnt, local_size))
+            local_size[0] = local_size[1] = local_size[2] = 0;
+
+        push_ranges = _layouts_info.push_ranges;
+        spirv_push_range_t range;
+        std::string err;
+        if (push_ranges.empty() && _layouts_info.reflect_push_constants) {
+            if (spirv_reflect_push_constants(code, word_cnt, range, &err))
+                push_ranges.push_back(VkPushConstantRange{
+                    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .offset = range.offset,
+                    .size = range.size,
+                });
+            else if (err.size())
+                EXCEPTION("Can't reflect the push constants of %s: %s, set "
+                        "layouts_info_t::push_ranges",
+                        _shader_info.path.size() ? _shader_info.path :
+                        _shader_info.name, err);
+        }
+
+        VkPipelineLayoutCreateInfo pipeline_layout_info{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            .setLayoutCount = (uint32_t)_layouts_info.desc_layout.size(),
+            .pSetLayouts = _layouts_info.desc_layout.data(),
+            .pushConstantRangeCount = (uint32_t)push_ranges.size(),
+            .pPushConstantRanges = push_ranges.data(),
+        };
+        if (vkCreatePipelineLayout(window->d->device, &pipeline_layout_info,
+                nullptr, &pipeline_layout) != VK_SUCCESS)
+            EXCEPTION("failed to create pipeline layout!");
+
+        /* the layout is released on error, so the creation can be retried */
+        try {
+            create_compute_pipeline();
+        }
+        catch (...) {
+            vkDestroyPipelineLayout(window->d->device, pipeline_layout,
+                    nullptr);
+            pipeline_layout = VK_NULL_HANDLE;
+            pipeline = VK_NULL_HANDLE;
+            throw;
+        }
+    }
+
+    /* the pipeline itself, after the layout */
+    void create_compute_pipeline() {
+        /* a workgroup the device can't run is an invalid pipeline, not an
+        error code, so it is rejected here */
+        auto &&limits = window->phydev.props.limits;
+        uint64_t invocations = uint64_t(local_size[0]) * local_size[1] *
+                local_size[2];
+        if (invocations > limits.maxComputeWorkGroupInvocations ||
+                local_size[0] > limits.maxComputeWorkGroupSize[0] ||
+                local_size[1] > limits.maxComputeWorkGroupSize[1] ||
+                local_size[2] > limits.maxComputeWorkGroupSize[2])
+            EXCEPTION("The workgroup %dx%dx%d of %s is too big for the device",
+                    local_size[0], local_size[1], local_size[2],
+                    _shader_info.path.size() ? _shader_info.path :
+                    _shader_info.name);
+
+        auto module = registry ?
+                registry->shader_modules.get(window, _shader_info) :
+                std::make_shared<ShaderModuleScope>(window, _shader_info);
+        spec_data_t spec_data(_shader_info.spec_constants);
+        VkComputePipelineCreateInfo pipeline_info{
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .stage = VkPipelineShaderStageCreateInfo{
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = module->module,
+                .pName = "main",
+                .pSpecializationInfo = spec_data.get(),
+            },
+            .layout = pipeline_layout,
+            .basePipelineHandle = VK_NULL_HANDLE,
+            .basePipelineIndex = -1,
+        };
+        if (vkCreateComputePipelines(window->d->device,
+                window->d->pipeline_cache, 1, &pipeline_info, nullptr,
+                &pipeline) != VK_SUCCESS)
+            EXCEPTION("failed to create compute pipeline!");
+    }
+
+    void bind(VkCommandBuffer cmd) const {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    }
+
+    void bind_descriptor_sets(VkCommandBuffer cmd,
+            const std::vector<VkDescriptorSet>& sets, uint32_t first = 0) const
+    {
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                pipeline_layout, first, (uint32_t)sets.size(), sets.data(),
+                0, nullptr);
+    }
+
+    template <typename T>
+    void push_constants(VkCommandBuffer cmd, const T& value,
+            uint32_t offset = 0) const
+    {
+        static_assert(std::is_trivially_copyable_v<T>,
+                "push constants are copied as raw bytes");
+        static_assert(sizeof(T) % 4 == 0,
+                "push constant sizes are multiples of 4");
+        if (offset % 4)
+            EXCEPTION("Push constant offset %d must be a multiple of 4", offset);
+        bool covered = std::any_of(push_ranges.begin(), push_ranges.end(),
+                [&](auto &&r) {
+                    return r.offset <= offset &&
+                            offset + sizeof(T) <= r.offset + r.size;
+                });
+        if (!covered)
+            EXCEPTION("No push constant range covers offset %d, size %ld",
+                    offset, sizeof(T));
+        vkCmdPushConstants(cmd, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                offset, sizeof(T), &value);
+    }
+
+    void dispatch(VkCommandBuffer cmd, uint32_t group_x, uint32_t group_y = 1,
+            uint32_t group_z = 1) const
+    {
+        vkCmdDispatch(cmd, group_x, group_y, group_z);
+    }
+
+    /* dispatches enough workgroups to cover the items, the shader has to
+    skip the invocations past the end */
+    void dispatch_items(VkCommandBuffer cmd, uint32_t items_x,
+            uint32_t items_y = 1, uint32_t items_z = 1) const
+    {
+        if (!local_size[0] || !local_size[1] || !local_size[2])
+            EXCEPTION("The workgroup size of %s isn't known, use dispatch",
+                    _shader_info.path.size() ? _shader_info.path :
+                    _shader_info.name);
+        auto groups = [](uint32_t items, uint32_t size) {
+            return (items + size - 1) / size;
+        };
+        vkCmdDispatch(cmd, groups(items_x, local_size[0]),
+                groups(items_y, local_size[1]),
+                groups(items_z, local_size[2]));
+    }
+
+    ~ComputePipeline() {
+        if (pipeline)
+            vkDestroyPipeline(window->d->device, pipeline, nullptr);
+        if (pipeline_layout)
+            vkDestroyPipelineLayout(window->d->device, pipeline_layout,
+                    nullptr);
+    }
+};
+
+} // namespace pge
+
+#endif
@@ -3,20 +3,43 @@
 
 #include <vector>
 #include <fstream>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <future>
+#include <atomic>
+#include <deque>
+#include <variant>
 
 #include "utils.h"
-#include "game_engine_st.h"
 #include "pge_window.h"
-#include "magic_enum.h"
+#include "pge_pipeline_data.h"
+#include "pge_shader_pack.h"
+#include "pge_spirv.h"
+#include "shader_compile.h"
 
 // this must be rebuilt
 
+/* Default optimization level of the shaders compiled at runtime, one of
+SHC_OPT_*. Can be set per build, ex: -DPGE_SHADER_OPT_LEVEL=SHC_OPT_ZERO for
+faster iteration on debug builds. */
+#ifndef PGE_SHADER_OPT_LEVEL
+# define PGE_SHADER_OPT_LEVEL SHC_OPT_PERFORMANCE
+#endif
+
 namespace pge
 {
 
 // general settings regardding pipeline creation
 struct base_pipeline_info_t {
     bool use_defaults = false;
+    bool async_shaders = true;  // load shaders on get_pipeline_pool()
+    bool allow_derivatives = false; // can be the base of derive_pipeline()
+
+    /* extra state set on the command buffer instead of being baked in, ex:
+    VK_DYNAMIC_STATE_LINE_WIDTH. The viewport and scissor are made dynamic
+    with viewport_info_t::dynamic */
+    std::vector<VkDynamicState> dynamic_states;
 };
 
 struct vert_input_info_t {
@@ -36,17 +59,84 @@ struct topology_info_t {
     bool restart_enable = false;
 };
 
+/* A dynamic viewport and scissor are set by PipelineDataScope::bind to the
+given extent, so the pipeline survives window resizes. Only minDepth and
+maxDepth of the viewport are used in that case. The viewport is static unless
+dynamic is asked for, use_defaults included:
+{ .use_defaults = true, .dynamic = true } covers the window and is dynamic. */
 struct viewport_info_t {
     bool use_defaults = false;
+    bool dynamic = false;
     VkViewport viewport;
     VkRect2D scissor;
 };
 
+/* Value of a specialization constant, by constant_id. A bool is given to the
+shader as a VkBool32, the others with their own size, so the type must match
+the declaration in the shader (ex: int for layout(constant_id = 0) const int) */
+using spec_value_t = std::variant<bool, int32_t, uint32_t, float, double>;
+using spec_constants_t = std::map<uint32_t, spec_value_t>;
+
+/* The VkSpecializationInfo of a set of constants, it points inside the struct
+so it can't be copied */
+struct spec_data_t {
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<uint8_t> data;
+    VkSpecializationInfo info;
+
+    spec_data_t(const spec_constants_t& constants) {
+        for (auto &&[id, value] : constants) {
+            uint32_t offset = data.size();
+            std::visit([&](auto v) {
+                if constexpr (std::is_same_v<decltype(v), bool>) {
+                    VkBool32 b = v;
+                    data.resize(offset + sizeof(b));
+                    memcpy(data.data() + offset, &b, sizeof(b));
+                }
+                else {
+                    data.resize(offset + sizeof(v));
+                    memcpy(data.data() + offset, &v, sizeof(v));
+                }
+            }, value);
+            entries.push_back(VkSpecializationMapEntry{
+                .constantID = id,
+                .offset = offset,
+                .size = data.size() - offset,
+            });
+        }
+        info = VkSpecializationInfo{
+            .mapEntryCount = (uint32_t)entries.size(),
+            .pMapEntries = entries.data(),
+            .dataSize = data.size(),
+            .pData = data.data(),
+        };
+    }
+
+    spec_data_t(const spec_data_t&) = delete;
+    spec_data_t& operator = (const spec_data_t&) = delete;
+
+    /* nullptr when there are no constants */
+    const VkSpecializationInfo *get() const {
+        return entries.empty() ? nullptr : &info;
+    }
+
+    /* the type takes part in the hash, 1 as an int and as a uint don't give
+    the same pipeline */
+    static void hash(Hasher& h, const spec_constants_t& constants) {
+        h.add(constants.size());
+        for (auto &&[id, value] : constants) {
+            h.add(id).add(value.index());
+            std::visit([&](auto v) { h.add(v); }, value);
+        }
+    }
+};
+
 enum ShaderLoadType {
     SHADER_LOAD_SRC,
     SHADER_LOAD_PATH,
     SHADER_LOAD_BYTECODE,
     SHADER_LOAD_BYTECODE_PATH,
+    SHADER_LOAD_PACK,   // name looked up in pack
 };
 struct shader_info_t {
     ShaderLoadType load_type = SHADER_LOAD_PATH;
@@ -54,7 +144,231 @@ struct shader_info_t {
     std::string code;
     std::string path;
     std::vector<uint32_t> bytecode;
-    bool optimize = true;
+    int opt_level = PGE_SHADER_OPT_LEVEL;
+    uint32_t opt_passes = 0;    // SHC_PASS_* flags
+    std::map<std::string, std::string> defines; // like -Dkey=value
+    spec_constants_t spec_constants;    // set at pipeline creation
+    const ShaderPack *pack = nullptr;
+
+    /* SHADER_LOAD_PACK and SHADER_LOAD_BYTECODE_PATH point those inside a
+    mapping instead of copying into bytecode. The pack must outlive the
+    pipeline creation, the file mapping is held by the info itself */
+    const uint32_t *mapped_code = nullptr;
+    size_t mapped_len = 0;
+    std::shared_ptr<MappedFile> mapping;
+
+    const uint32_t *get_code() const {
+        return mapped_code ? mapped_code : bytecode.data();
+    }
+
+    size_t get_code_size() const {
+        return (mapped_code ? mapped_len : bytecode.size()) * sizeof(uint32_t);
+    }
+};
+
+#ifndef PGE_NO_SHADERC
+/* The shader compiler used by load_shader, loaded from PGE_SHADERC_PATH the
+first time a shader is compiled at runtime. It's SPIR-V cache is kept in
+PGE_SHADER_CACHE_DIR, "" turns it off. */
+#ifndef PGE_SHADERC_PATH
+# define PGE_SHADERC_PATH "./libshc.so"
+#endif
+
+#ifndef PGE_SHADER_CACHE_DIR
+# define PGE_SHADER_CACHE_DIR "shader_cache/"
+#endif
+
+inline ShaderC& get_shaderc() {
+    static ShaderC shc;
+    static bool loaded = shc.load(PGE_SHADERC_PATH) == 0;
+    if (!loaded)
+        EXCEPTION("Couldn't load the shader compiler from %s",
+                PGE_SHADERC_PATH);
+    static bool cache_set =
+            shc.shc_set_cache_dir_fn(PGE_SHADER_CACHE_DIR) == 0;
+    if (!cache_set)
+        EXCEPTION("Couldn't use %s as the shader cache directory",
+                PGE_SHADER_CACHE_DIR);
+    return shc;
+}
+
+/* A compiler context per thread, the pool's workers compile in parallel */
+inline shc_ctx_t *get_shaderc_ctx() {
+    struct ctx_scope_t {
+        shc_ctx_t *ctx = get_shaderc().shc_create_ctx_fn();
+        ~ctx_scope_t() { get_shaderc().shc_destroy_ctx_fn(ctx); }
+    };
+    thread_local ctx_scope_t scope;
+    return scope.ctx;
+}
+
+/* compiles SHADER_LOAD_PATH and SHADER_LOAD_SRC into info.bytecode, left
+empty on failure */
+inline void compile_shader(shader_info_t &info, int type) {
+    std::vector<shc_define_t> defines;
+    for (auto &&[name, value] : info.defines)
+        defines.push_back(shc_define_t{ name.c_str(), value.c_str() });
+    shc_opts_t opts{
+        .kind = type,
+        .opt_level = info.opt_level,
+        .passes = info.opt_passes,
+        .defines = defines.data(),
+        .define_cnt = defines.size(),
+    };
+    auto &&shc = get_shaderc();
+    int ret = info.load_type == SHADER_LOAD_PATH ?
+            shc.compile_path(info.path.c_str(), opts, info.bytecode,
+                    get_shaderc_ctx()) :
+            shc.compile_src(info.name.c_str(), info.code.c_str(), opts,
+                    info.bytecode, get_shaderc_ctx());
+    if (ret != SHC_OK) {
+        DBG("Failed to compile %s: %d", info.path.size() ? info.path :
+                info.name, ret);
+        info.bytecode.clear();
+    }
+}
+#endif
+
+inline void load_shader(shader_info_t &info, int type) {
+    if (info.spec_constants.size() && (info.opt_passes & SHC_PASS_FOLD_SPEC))
+        EXCEPTION("SHC_PASS_FOLD_SPEC freezes the spec constants of %s, they "
+                "can't be set", info.path.size() ? info.path : info.name);
+    switch (info.load_type) {
+#ifndef PGE_NO_SHADERC
+        case SHADER_LOAD_PATH:
+        case SHADER_LOAD_SRC:
+            compile_shader(info, type);
+            break;
+#else
+        case SHADER_LOAD_PATH:
+        case SHADER_LOAD_SRC:
+            EXCEPTION("Built with PGE_NO_SHADERC, use precompiled shaders");
+#endif
+        case SHADER_LOAD_PACK: {
+            if (!info.pack)
+                EXCEPTION("SHADER_LOAD_PACK needs a pack");
+            auto entry = info.pack->find(info.name);
+            if (!entry)
+                EXCEPTION("Shader %s not found in the pack", info.name);
+            std::string err;
+            if (!spirv_validate(info.pack->get_code(entry),
+                    entry->size / sizeof(uint32_t), &err))
+                EXCEPTION("Invalid SPIR-V for %s in pack: %s", info.name, err);
+            info.mapped_code = info.pack->get_code(entry);
+            info.mapped_len = entry->size / sizeof(uint32_t);
+        } break;
+        case SHADER_LOAD_BYTECODE_PATH: {
+            auto view = spirv_map_file(info.path);
+            info.mapping = view.file;
+            info.mapped_code = view.code;
+            info.mapped_len = view.word_cnt;
+        } break;
+        case SHADER_LOAD_BYTECODE:
+            // nothing to do
+            break;
+        default: EXCEPTION("Unknown shader load type");
+    }
+}
+
+/* Shared by all the pipelines for background work, like loading shaders */
+inline ThreadPool& get_pipeline_pool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+/* The async creations block on the shader loads, on their own workers so a
+creation never waits for a load queued behind it. The load pool is made first
+to be destroyed last */
+inline ThreadPool& get_pipeline_create_pool() {
+    get_pipeline_pool();
+    static ThreadPool pool;
+    return pool;
+}
+
+/* Permutations of a shader over a declared set of toggles. A variant is a
+bitmask over keys, bit i set means keys[i] is defined (as 1) on top of the
+base defines. Each variant is compiled the first time it is requested, on the
+pool if one is given, and kept for later requests. The base must be GLSL
+(SHADER_LOAD_PATH or SHADER_LOAD_SRC), compiled bytecode has no defines left to
+toggle and is rejected. */
+struct ShaderVariants {
+    shader_info_t base;
+    int type;
+    std::vector<std::string> keys;
+    ThreadPool *pool = nullptr;
+
+    ShaderVariants(shader_info_t base, int type, std::vector<std::string> keys,
+            ThreadPool *pool = nullptr)
+    : base(base), type(type), keys(keys), pool(pool)
+    {
+        if (keys.size() > 64)
+            EXCEPTION("A shader can have at most 64 variant keys, not %ld",
+                    keys.size());
+        if (base.load_type != SHADER_LOAD_PATH &&
+                base.load_type != SHADER_LOAD_SRC)
+            EXCEPTION("The variants of shader %s need it's GLSL source "
+                    "(SHADER_LOAD_PATH or SHADER_LOAD_SRC), bytecode can't be "
+                    "recompiled with other defines",
+                    base.path.size() ? base.path : base.name);
+    }
+
+    uint64_t get_mask(std::initializer_list<std::string> enabled) const {
+        uint64_t mask = 0;
+        for (auto &&key : enabled) {
+            auto it = std::find(keys.begin(), keys.end(), key);
+            if (it == keys.end())
+                EXCEPTION("Unknown variant key %s for shader %s", key,
+                        base.path.size() ? base.path : base.name);
+            mask |= 1ULL << (it - keys.begin());
+        }
+        return mask;
+    }
+
+    /* starts the compilation of the variant if it isn't already started, in
+    the background if there is a pool */
+    std::shared_future<std::vector<uint32_t>> request(uint64_t mask) {
+        std::lock_guard<std::mutex> guard(mu);
+        auto it = variants.find(mask);
+        if (it != variants.end())
+            return it->second;
+
+        shader_info_t info = get_info(mask);
+        auto compile = [info, type = type]() mutable {
+            load_shader(info, type);
+            return std::move(info.bytecode);
+        };
+        std::shared_future<std::vector<uint32_t>> ret;
+        if (pool)
+            ret = pool->submit(std::move(compile)).share();
+        else
+            ret = std::async(std::launch::deferred, std::move(compile)).share();
+        variants[mask] = ret;
+        return ret;
+    }
+
+    /* returns the shader info of the compiled variant, ready to be used as
+    SHADER_LOAD_BYTECODE */
+    shader_info_t get(uint64_t mask) {
+        shader_info_t info = get_info(mask);
+        info.bytecode = request(mask).get();
+        info.load_type = SHADER_LOAD_BYTECODE;
+        if (info.bytecode.empty())
+            EXCEPTION("Failed to compile variant %lx of shader %s", mask,
+                    base.path.size() ? base.path : base.name);
+        return info;
+    }
+
+private:
+    std::mutex mu;
+    std::map<uint64_t, std::shared_future<std::vector<uint32_t>>> variants;
+
+    shader_info_t get_info(uint64_t mask) const {
+        shader_info_t info = base;
+        for (size_t i = 0; i < keys.size(); i++)
+            if (mask & (1ULL << i))
+                info.defines[keys[i]] = "1";
+        return info;
+    }
 };
 struct vert_shader_info_t {
     // does not have default values
@@ -66,6 +380,23 @@ struct frag_shader_info_t {
     shader_info_t info;
 };
 
+/* Tessellation of patches of patch_control_points vertices, the topology of
+the input assembly becomes VK_PRIMITIVE_TOPOLOGY_PATCH_LIST, without primitive
+restart. A pipeline that skips the stage (or uses the defaults) has no
+tessellation. */
+struct tess_info_t {
+    bool use_defaults = false;
+    shader_info_t control;
+    shader_info_t evaluation;
+    uint32_t patch_control_points = 3;
+};
+
+/* A geometry shader, none if the stage is skipped (or uses the defaults) */
+struct geom_shader_info_t {
+    bool use_defaults = false;
+    shader_info_t info;
+};
+
 
 // VK_POLYGON_MODE_FILL
 // VK_POLYGON_MODE_LINE
@@ -89,6 +420,30 @@ struct color_blending_info_t {
     bool enabled = false;
 };
 
+/* Depth and stencil tests, only used when the subpass has a depth attachment.
+depth_only makes a depth pre-pass pipeline: the fragment stage is left out and
+nothing is written to the color attachments (see
+DrawPipeline::depth_prepass_of). */
+struct depth_stencil_info_t {
+    bool use_defaults = false;
+    bool depth_test = true;
+    bool depth_write = true;
+    VkCompareOp compare_op = VK_COMPARE_OP_LESS;
+    bool stencil_test = false;
+    VkStencilOpState front = {};
+    VkStencilOpState back = {};
+    bool depth_only = false;
+
+    /* for the pipeline drawn after a pre-pass: the depth is already there, so
+    only the visible fragments pass and nothing is written */
+    static depth_stencil_info_t get_after_prepass() {
+        return depth_stencil_info_t{
+            .depth_write = false,
+            .compare_op = VK_COMPARE_OP_EQUAL,
+        };
+    }
+};
+
 struct multisample_info_t {
     bool use_defaults = false;
     VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
@@ -96,22 +451,425 @@ struct multisample_info_t {
     float min_sample_shading = 1.0f;
 };
 
+/* If push_ranges is empty and reflect_push_constants is set, the ranges are
+taken from the push constant blocks of the shaders */
 struct layouts_info_t {
     bool use_defaults = false;
     std::vector<VkDescriptorSetLayout> desc_layout;
+    std::vector<VkPushConstantRange> push_ranges;
+    bool reflect_push_constants = true;
+};
+
+/* The render pass a pipeline is made for and the subpass it draws in. All the
+pipelines of a render pass must be given the same description. */
+struct render_pass_info_t {
+    bool use_defaults = false;
+    RenderPass render_pass;     // RenderPass::get_default if left empty
+    uint32_t subpass = 0;
+};
+
+struct RenderPassScope {
+    PgeWindow *window = nullptr;
+    VkRenderPass render_pass = nullptr;
+
+    RenderPassScope(PgeWindow *window, const RenderPass& desc)
+    : window(window), render_pass(desc.create(window->d->device)) {}
+
+    ~RenderPassScope() {
+        if (render_pass)
+            vkDestroyRenderPass(window->d->device, render_pass, nullptr);
+    }
+};
+
+/* Render passes by the hash of their description, shared by the pipelines and
+the framebuffers made for them. trim() releases the unused ones. */
+struct RenderPassCache {
+    std::shared_ptr<RenderPassScope> get(PgeWindow *window,
+            const RenderPass& desc)
+    {
+        uint64_t hash = desc.get_hash();
+        std::lock_guard<std::mutex> guard(mu);
+        auto it = render_passes.find(hash);
+        if (it != render_passes.end())
+            return it->second;
+        auto entry = std::make_shared<RenderPassScope>(window, desc);
+        render_passes[hash] = entry;
+        return entry;
+    }
+
+    size_t trim() {
+        std::lock_guard<std::mutex> guard(mu);
+        return std::erase_if(render_passes, [](auto &&entry) {
+            return entry.second.use_count() == 1;
+        });
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> guard(mu);
+        return render_passes.size();
+    }
+
+private:
+    std::mutex mu;
+    std::map<uint64_t, std::shared_ptr<RenderPassScope>> render_passes;
+};
+
+inline int find_memory_type(VkPhysicalDevice phy_dev, uint32_t type_bits,
+        VkMemoryPropertyFlags props)
+{
+    VkPhysicalDeviceMemoryProperties mem_props;
+    vkGetPhysicalDeviceMemoryProperties(phy_dev, &mem_props);
+    for (uint32_t i = 0; i < mem_props.memoryTypeCount; i++)
+        if ((type_bits & (1 << i)) &&
+                (mem_props.memoryTypes[i].propertyFlags & props) == props)
+            return i;
+    return -1;
+}
+
+/* The image behind an attachment. Transient usage asks for lazily allocated
+memory, that the tilers never back with real memory, and falls back on device
+local memory where there is none (ex: desktop GPUs, lavapipe). memory_types
+masks the memory types it may use, all of them by default. */
+struct AttachmentImageScope {
+    PgeWindow *window = nullptr;
+    VkImage image = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    bool lazy = false;
+
+    AttachmentImageScope(PgeWindow *window, const attachment_info_t& att,
+            VkImageUsageFlags usage, VkExtent2D extent,
+            uint32_t memory_types = ~0u)
+    : window(window)
+    {
+        auto device = window->d->device;
+        VkImageCreateInfo image_info{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = att.format,
+            .extent = { extent.width, extent.height, 1 },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = att.samples,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+        if (vkCreateImage(device, &image_info, nullptr, &image) != VK_SUCCESS)
+            EXCEPTION("failed to create attachment image!");
+
+        VkMemoryRequirements mem_reqs;
+        vkGetImageMemoryRequirements(device, image, &mem_reqs);
+        mem_reqs.memoryTypeBits &= memory_types;
+        int type = -1;
+        if (usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+            type = find_memory_type(window->phydev.phy_dev,
+                    mem_reqs.memoryTypeBits,
+                    VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+        lazy = type >= 0;
+        if (type < 0)
+            type = find_memory_type(window->phydev.phy_dev,
+                    mem_reqs.memoryTypeBits,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if (type < 0) {
+            release();
+            EXCEPTION("No memory type for the attachment image");
+        }
+
+        VkMemoryAllocateInfo alloc_info{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize = mem_reqs.size,
+            .memoryTypeIndex = (uint32_t)type,
+        };
+        if (vkAllocateMemory(device, &alloc_info, nullptr, &memory)
+                != VK_SUCCESS)
+        {
+            release();
+            EXCEPTION("failed to allocate attachment memory!");
+        }
+        if (vkBindImageMemory(device, image, memory, 0) != VK_SUCCESS) {
+            release();
+            EXCEPTION("failed to bind attachment memory!");
+        }
+
+        VkImageViewCreateInfo view_info{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = att.format,
+            .subresourceRange = {
+                .aspectMask = get_format_aspect(att.format),
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        };
+        if (vkCreateImageView(device, &view_info, nullptr, &view)
+                != VK_SUCCESS)
+        {
+            release();
+            EXCEPTION("failed to create attachment image view!");
+        }
+    }
+
+    AttachmentImageScope(const AttachmentImageScope&) = delete;
+    AttachmentImageScope& operator = (const AttachmentImageScope&) = delete;
+
+    ~AttachmentImageScope() {
+        release();
+    }
+
+private:
+    void release() {
+        auto device = window->d->device;
+        if (view)
+            vkDestroyImageView(device, view, nullptr);
+        if (image)
+            vkDestroyImage(device, image, nullptr);
+        if (memory)
+            vkFreeMemory(device, memory, nullptr);
+        view = VK_NULL_HANDLE;
+        image = VK_NULL_HANDLE;
+        memory = VK_NULL_HANDLE;
+    }
+};
+
+/* A framebuffer for a render pass of the description desc. The transient
+attachments get their own images, views gives the others in the order of the
+attachments, ex: the swapchain image view. */
+struct FramebufferScope {
+    PgeWindow *window = nullptr;
+    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    std::vector<std::unique_ptr<AttachmentImageScope>> images;
+
+    FramebufferScope(PgeWindow *window, const RenderPass& desc,
+            VkRenderPass render_pass, VkExtent2D extent,
+            const std::vector<VkImageView>& views)
+    : window(window)
+    {
+        std::vector<VkImageView> attachments;
+        size_t next_view = 0;
+        for (uint32_t i = 0; i < desc.attachments.size(); i++) {
+            auto &&att = desc.attachments[i];
+            if (att.transient) {
+                images.push_back(std::make_unique<AttachmentImageScope>(window,
+                        att, desc.get_usage(i), extent));
+                attachments.push_back(images.back()->view);
+            }
+            else {
+                if (next_view >= views.size())
+                    EXCEPTION("Missing the view of attachment %d", i);
+                attachments.push_back(views[next_view++]);
+            }
+        }
+        if (next_view != views.size())
+            EXCEPTION("Got %ld views for %ld attachments", views.size(),
+                    next_view);
+
+        VkFramebufferCreateInfo framebuffer_info{
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = render_pass,
+            .attachmentCount = (uint32_t)attachments.size(),
+            .pAttachments = attachments.data(),
+            .width = extent.width,
+            .height = extent.height,
+            .layers = 1,
+        };
+        if (vkCreateFramebuffer(window->d->device, &framebuffer_info, nullptr,
+                &framebuffer) != VK_SUCCESS)
+            EXCEPTION("failed to create framebuffer!");
+    }
+
+    ~FramebufferScope() {
+        if (framebuffer)
+            vkDestroyFramebuffer(window->d->device, framebuffer, nullptr);
+    }
 };
 
-struct render_subpass_info_t {
-    // TODO
+struct ShaderModuleScope {
+    PgeWindow *window = nullptr;
+    VkShaderModule module = nullptr;
+
+    ShaderModuleScope(PgeWindow *window, const shader_info_t& info)
+    : window(window)
+    {
+        VkShaderModuleCreateInfo module_info{
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .codeSize = info.get_code_size(),
+            .pCode = info.get_code(),
+        };
+        if (vkCreateShaderModule(window->d->device, &module_info, nullptr,
+                &module) != VK_SUCCESS)
+            EXCEPTION("failed to create shader module!");
+    }
+
+    ~ShaderModuleScope() {
+        if (module)
+            vkDestroyShaderModule(window->d->device, module, nullptr);
+    }
+};
+
+/* Shader modules by the hash of their SPIR-V, so a vertex shader used by many
+pipelines is given to the driver only once. Each module keeps a copy of it's
+code, compared on a hit, so two shaders with the same hash get their own
+module. The modules stay alive after the pipelines are created, trim()
+releases the ones nobody holds. */
+struct ShaderModuleCache {
+    std::shared_ptr<ShaderModuleScope> get(PgeWindow *window,
+            const shader_info_t& info)
+    {
+        auto code = info.get_code();
+        size_t code_size = info.get_code_size();
+        uint64_t hash = fnv1a_64(code, code_size);
+        std::lock_guard<std::mutex> guard(mu);
+        auto &bucket = modules[hash];
+        for (auto &&entry : bucket)
+            if (entry.code.size() * sizeof(uint32_t) == code_size &&
+                    std::equal(entry.code.begin(), entry.code.end(), code))
+                return entry.module;
+        bucket.push_back(entry_t{
+            .code = std::vector<uint32_t>(code,
+                    code + code_size / sizeof(uint32_t)),
+            .module = std::make_shared<ShaderModuleScope>(window, info),
+        });
+        return bucket.back().module;
+    }
+
+    size_t trim() {
+        std::lock_guard<std::mutex> guard(mu);
+        size_t ret = 0;
+        for (auto &&[hash, bucket] : modules)
+            ret += std::erase_if(bucket, [](auto &&entry) {
+                return entry.module.use_count() == 1;
+            });
+        std::erase_if(modules, [](auto &&bucket) {
+            return bucket.second.empty();
+        });
+        return ret;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> guard(mu);
+        size_t ret = 0;
+        for (auto &&[hash, bucket] : modules)
+            ret += bucket.size();
+        return ret;
+    }
+
+private:
+    struct entry_t {
+        std::vector<uint32_t> code;
+        std::shared_ptr<ShaderModuleScope> module;
+    };
+
+    std::mutex mu;
+    std::map<uint64_t, std::vector<entry_t>> modules;
 };
 
-/* should know about:
-        - attachments
-        - attachemts refs
-        - subpass
-        - dependencyes
-*/
-struct RenderPass {
+/* Pipelines indexed by the hash of their whole state (see
+DrawPipeline::get_state_hash), so identical descriptions end up sharing one
+VkPipeline, layout and render pass. All the pipelines of a registry must belong
+to the same window. Entries are kept alive by the registry, trim() releases the
+ones no DrawPipeline uses anymore. Thread safe, a pipeline is created only once
+even when it is requested from multiple threads at the same time. */
+struct PipelineRegistry {
+    using data_ptr_t = std::shared_ptr<PipelineDataScope>;
+
+    /* the pipelines' render passes, framebuffers can get theirs from here */
+    RenderPassCache render_passes;
+    ShaderModuleCache shader_modules;
+
+    /* created is set to false if the pipeline already existed */
+    template <typename Fn>
+    data_ptr_t get_or_create(uint64_t hash, Fn&& create,
+            bool *created = nullptr)
+    {
+        std::promise<data_ptr_t> promise;
+        std::shared_future<data_ptr_t> entry;
+        {
+            std::lock_guard<std::mutex> guard(mu);
+            auto it = pipelines.find(hash);
+            if (it != pipelines.end()) {
+                entry = it->second;
+                hits++;
+            }
+            else
+                pipelines[hash] = promise.get_future().share();
+        }
+        if (created)
+            *created = !entry.valid();
+        /* may wait for the thread that creates it */
+        if (entry.valid())
+            return entry.get();
+
+        /* created outside the lock, the driver can take a while */
+        try {
+            data_ptr_t ret = create();
+            promise.set_value(ret);
+            return ret;
+        }
+        catch (...) {
+            promise.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> guard(mu);
+            pipelines.erase(hash);
+            throw;
+        }
+    }
+
+    /* returns nullptr if there is no pipeline with this hash, waits for it if
+    it is being created */
+    data_ptr_t find(uint64_t hash) {
+        std::shared_future<data_ptr_t> entry;
+        {
+            std::lock_guard<std::mutex> guard(mu);
+            auto it = pipelines.find(hash);
+            if (it == pipelines.end())
+                return nullptr;
+            entry = it->second;
+            hits++;
+        }
+        return entry.get();
+    }
+
+    /* destroys the pipelines that are only referenced by the registry, and
+    after them the render passes nobody uses. Shader modules are only needed
+    while pipelines are created, so trimming them is left to the caller (see
+    ShaderModuleCache::trim). Returns how many pipelines were destroyed */
+    size_t trim() {
+        std::lock_guard<std::mutex> guard(mu);
+        size_t cnt = 0;
+        for (auto it = pipelines.begin(); it != pipelines.end();) {
+            auto &entry = it->second;
+            if (entry.wait_for(std::chrono::seconds(0)) ==
+                    std::future_status::ready && entry.get().use_count() == 1)
+            {
+                it = pipelines.erase(it);
+                cnt++;
+            }
+            else
+                it++;
+        }
+        render_passes.trim();
+        return cnt;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> guard(mu);
+        return pipelines.size();
+    }
+
+    /* how many requests were served by an existing pipeline */
+    size_t get_hits() {
+        std::lock_guard<std::mutex> guard(mu);
+        return hits;
+    }
+
+private:
+    std::mutex mu;
+    std::map<uint64_t, std::shared_future<data_ptr_t>> pipelines;
+    size_t hits = 0;
 };
 
 struct DrawPipeline {
@@ -121,87 +879,56 @@ struct DrawPipeline {
     topology_info_t _topology_info;
     viewport_info_t _viewport_info;
     vert_shader_info_t _vert_shader_info;
+    tess_info_t _tess_info = { .use_defaults = true };
+    geom_shader_info_t _geom_shader_info = { .use_defaults = true };
     rasterizer_info_t _raster_info;
     multisample_info_t _msample_info;
     color_blending_info_t _blend_info;
     frag_shader_info_t _frag_shader_info;
+    depth_stencil_info_t _depth_info;
     layouts_info_t _layouts_info;
-    std::vector<render_subpass_info_t> render_subpasses;
+    render_pass_info_t _render_pass_info;
 
-    /* you can bind pipeline creator to a pipeline to create another pipeline
-    from it */
-    struct PipelineCreator {
-        enum PipelineState {
-            STATE_NONE,
-            STATE_CONSTRUCTOR,
-            STATE_INIT_START,
-            STATE_VERTEX_INPUT,
-            STATE_INPUT_ASSEMBLY,
-            STATE_VIEWPORT,
-            STATE_VERTEX_SHADER,
-            STATE_RASTERIZER,
-            STATE_MULTISAMPLER,
-            STATE_FRAGMENT_SHADER,
-            STATE_COLOR_BLENDING,
-            STATE_LAYOUTS,
-            STATE_RENDER_SUBPASS,
-            STATE_INIT_DONE,
-        };
-        PipelineState init_state = STATE_NONE;
+    /* shaders still loading by stage, create_pipeline waits for them */
+    std::map<VkShaderStageFlagBits, std::future<shader_info_t>> _shader_loads;
 
-        struct Scope {
-            PipelineCreator &scope;
-
-            Scope (PipelineCreator &scope) : scope(scope) {
-                scope.init_state = STATE_CONSTRUCTOR;
-            }
-            ~Scope() {
-                scope.check_init_done();
-            }
-            PipelineCreator * operator -> () const {
-                return &scope;
-            } 
-        };
+    /* Type-state builder, every stage returns the creator of the next state,
+    so stages called out of order don't compile. derived creators start from
+    the state of a base pipeline (see derive_pipeline) */
+    template <PipelineState state, bool derived = false>
+    struct PipelineCreator {
+        DrawPipeline &pipeline;
 
-        DrawPipeline& pipeline;
-        PipelineCreator(DrawPipeline& pipeline) : pipeline(pipeline) {}
+        template <PipelineState next>
+        using next_t = PipelineCreator<next, derived>;
 
-        PipelineCreator *start_pipeline(
-                base_pipeline_info_t pipeline_info = { .use_defaults = true })
-        {
-            state_transition({STATE_CONSTRUCTOR}, STATE_INIT_START);
-            if (pipeline_info.use_defaults)
-                pipeline_info = base_pipeline_info_t{};
-            pipeline._base_pipeline_info = pipeline_info;
-            return this;
-        }
-
-        PipelineCreator *add_vertex_input(
+        [[nodiscard]] next_t<STATE_VERTEX_INPUT> add_vertex_input(
                 vert_input_info_t vert_info = { .use_defaults = true})
+        requires (pipeline_can_enter(state, STATE_VERTEX_INPUT, derived))
         {
-            state_transition({STATE_INIT_START}, STATE_VERTEX_INPUT);
             if (vert_info.use_defaults)
                 vert_info = vert_input_info_t{};
             pipeline._vert_info = vert_info;
-            return this;
+            return { pipeline };
         }
 
-        PipelineCreator *add_input_assembly(
+        [[nodiscard]] next_t<STATE_INPUT_ASSEMBLY> add_input_assembly(
                 topology_info_t topology = { .use_defaults = true})
+        requires (pipeline_can_enter(state, STATE_INPUT_ASSEMBLY, derived))
         {
-            state_transition({STATE_VERTEX_INPUT}, STATE_INPUT_ASSEMBLY);
             if (topology.use_defaults)
                 topology = topology_info_t{};
             pipeline._topology_info = topology;
-            return this;
+            return { pipeline };
         }
 
-        PipelineCreator *add_viewport(
+        [[nodiscard]] next_t<STATE_VIEWPORT> add_viewport(
                 viewport_info_t vp_info = { .use_defaults = true })
+        requires (pipeline_can_enter(state, STATE_VIEWPORT, derived))
         {
-            state_transition({STATE_INPUT_ASSEMBLY}, STATE_VIEWPORT);
             if (vp_info.use_defaults)
                 vp_info = viewport_info_t{
+                    .dynamic = vp_info.dynamic,
                     .viewport = {
                         .x = 0.0f,
                         .y = 0.0f,
@@ -216,185 +943,580 @@ struct DrawPipeline {
                     }
                 };
             pipeline._viewport_info = vp_info;
-            return this;
+            return { pipeline };
         }
 
-        PipelineCreator *add_vertex_shader(vert_shader_info_t shader_info) {
-            state_transition({STATE_VIEWPORT}, STATE_VERTEX_SHADER);
+        [[nodiscard]] next_t<STATE_VERTEX_SHADER> add_vertex_shader(
+                vert_shader_info_t shader_info)
+        requires (pipeline_can_enter(state, STATE_VERTEX_SHADER, derived))
+        {
             pipeline._vert_shader_info = shader_info;
-            load_shader(pipeline._vert_shader_info.info, VERTEX_SHADER);
-            return this;
+            pipeline.start_load(VK_SHADER_STAGE_VERTEX_BIT,
+                    SHC_VERTEX_SHADER);
+            return { pipeline };
+        }
+
+        [[nodiscard]] next_t<STATE_TESSELLATION> add_tessellation(
+                tess_info_t tess_info = { .use_defaults = true })
+        requires (pipeline_can_enter(state, STATE_TESSELLATION, derived))
+        {
+            pipeline._tess_info = tess_info;
+            if (tess_info.use_defaults)
+                return { pipeline };
+            pipeline.start_load(VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+                    SHC_TESS_CONTROL_SHADER);
+            pipeline.start_load(VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+                    SHC_TESS_EVALUATION_SHADER);
+            return { pipeline };
         }
 
-        PipelineCreator *add_rasterizer(
+        [[nodiscard]] next_t<STATE_GEOMETRY_SHADER> add_geometry_shader(
+                geom_shader_info_t shader_info = { .use_defaults = true })
+        requires (pipeline_can_enter(state, STATE_GEOMETRY_SHADER, derived))
+        {
+            pipeline._geom_shader_info = shader_info;
+            if (!shader_info.use_defaults)
+                pipeline.start_load(VK_SHADER_STAGE_GEOMETRY_BIT,
+                        SHC_GEOMETRY_SHADER);
+            return { pipeline };
+        }
+
+        [[nodiscard]] next_t<STATE_RASTERIZER> add_rasterizer(
                 rasterizer_info_t raster_info = { .use_defaults = true })
+        requires (pipeline_can_enter(state, STATE_RASTERIZER, derived))
         {
-            state_transition({STATE_VERTEX_SHADER}, STATE_RASTERIZER);
             if (raster_info.use_defaults)
                 raster_info = rasterizer_info_t{};
             pipeline._raster_info = raster_info;
-            return this;
+            return { pipeline };
         }
 
-        PipelineCreator *add_multisampler(
+        [[nodiscard]] next_t<STATE_MULTISAMPLER> add_multisampler(
                 multisample_info_t multi_info = { .use_defaults = true })
+        requires (pipeline_can_enter(state, STATE_MULTISAMPLER, derived))
         {
-            state_transition({STATE_RASTERIZER}, STATE_MULTISAMPLER);
             if (multi_info.use_defaults)
                 multi_info = multisample_info_t{};
             pipeline._msample_info = multi_info;
-            return this;
+            return { pipeline };
         }
 
-        PipelineCreator *add_fragment_shader(frag_shader_info_t shader_info) {
-            state_transition({STATE_MULTISAMPLER}, STATE_FRAGMENT_SHADER);
+        [[nodiscard]] next_t<STATE_FRAGMENT_SHADER> add_fragment_shader(
+                frag_shader_info_t shader_info)
+        requires (pipeline_can_enter(state, STATE_FRAGMENT_SHADER, derived))
+        {
             pipeline._frag_shader_info = shader_info;
-            load_shader(pipeline._frag_shader_info.info, FRAGMENT_SHADER);
-            return this;
+            pipeline.start_load(VK_SHADER_STAGE_FRAGMENT_BIT,
+                    SHC_FRAGMENT_SHADER);
+            return { pipeline };
         }
 
-        PipelineCreator *add_color_blending(
+        [[nodiscard]] next_t<STATE_DEPTH_STENCIL> add_depth_stencil(
+                depth_stencil_info_t depth_info = { .use_defaults = true })
+        requires (pipeline_can_enter(state, STATE_DEPTH_STENCIL, derived))
+        {
+            if (depth_info.use_defaults)
+                depth_info = depth_stencil_info_t{};
+            pipeline._depth_info = depth_info;
+            return { pipeline };
+        }
+
+        [[nodiscard]] next_t<STATE_COLOR_BLENDING> add_color_blending(
                 color_blending_info_t blending_info = { .use_defaults = true })
+        requires (pipeline_can_enter(state, STATE_COLOR_BLENDING, derived))
         {
-            state_transition({STATE_FRAGMENT_SHADER}, STATE_COLOR_BLENDING);
             if (blending_info.use_defaults)
                 blending_info = color_blending_info_t{};
             pipeline._blend_info = blending_info;
-            return this;
+            return { pipeline };
         }
 
-        PipelineCreator *add_layouts(
+        [[nodiscard]] next_t<STATE_LAYOUTS> add_layouts(
                 layouts_info_t layouts_info = { .use_defaults = true })
+        requires (pipeline_can_enter(state, STATE_LAYOUTS, derived))
         {
-            state_transition({STATE_COLOR_BLENDING}, STATE_LAYOUTS);
             if (layouts_info.use_defaults)
                 layouts_info = layouts_info_t{};
             pipeline._layouts_info = layouts_info;
-            return this;
+            return { pipeline };
         }
 
-        PipelineCreator *add_render_subpass(render_subpass_info_t render_pass) {
-            state_transition({STATE_LAYOUTS, STATE_RENDER_SUBPASS},
-                    STATE_RENDER_SUBPASS);
-            /* render subpass is a bit special, as we can have more of them
-            and we collect them till the end of the pipeline */
-            // TODO: 
-            return this;
+        [[nodiscard]] next_t<STATE_RENDER_PASS> add_render_pass(
+                render_pass_info_t render_pass_info = { .use_defaults = true })
+        requires (pipeline_can_enter(state, STATE_RENDER_PASS, derived))
+        {
+            if (render_pass_info.use_defaults)
+                render_pass_info = render_pass_info_t{};
+            pipeline._render_pass_info = render_pass_info;
+            return { pipeline };
         }
 
-        PipelineCreator *end_pipeline(bool create_it = true) {
-            state_transition({STATE_RENDER_SUBPASS}, STATE_INIT_DONE);
+        void end_pipeline(bool create_it = true)
+        requires (pipeline_can_enter(state, STATE_INIT_DONE, derived))
+        {
             if (create_it)
                 pipeline.create_pipeline();
-            return this;
-        }
-
-        void load_shader(shader_info_t &info, int type) {
-            switch (info.load_type) {
-                case SHADER_LOAD_PATH:
-                    info.bytecode = compile_shader_path(
-                            info.path, type, info.optimize);
-                    break;
-                case SHADER_LOAD_SRC:
-                    info.bytecode = compile_shader_src(info.name,
-                            info.path, type, info.optimize);
-                    break;
-                case SHADER_LOAD_BYTECODE_PATH: {
-                    std::ifstream input(info.path, std::ios::binary);
-
-                    std::vector<char> bytes(
-                         (std::istreambuf_iterator<char>(input)),
-                         (std::istreambuf_iterator<char>()));
-
-                    input.close();
-                    info.bytecode.resize(
-                            bytes.size() / 4 + !!(bytes.size() % 4));
-                    memcpy(info.bytecode.data(), bytes.data(), bytes.size());
-                } break;
-                case SHADER_LOAD_BYTECODE:
-                    // nothing to do
-                    break;
-                default: EXCEPTION("Unknown shader load type");
-            }
         }
+    };
+
+    /* the version the render thread draws with, see publish() */
+    PipelineVersions _versions;
+
+    PgeWindow *window = nullptr;
+    PipelineRegistry *registry = nullptr;
+
+    /* the parent of a derived pipeline */
+    DrawPipeline *base = nullptr;
+
+    /* used by get_drawable() while create_pipeline_async() runs, read by the
+    render thread while it is set */
+    std::atomic<DrawPipeline *> fallback = nullptr;
+
+    /* shared, the derivatives created on other workers wait on it too */
+    std::shared_future<void> _async_create;
+    std::mutex _async_mu;
+
+    /* with a registry, identical pipelines share the vulkan objects */
+    DrawPipeline(PgeWindow *window, PipelineRegistry *registry = nullptr)
+    : _versions(window ? &window->d->retire_queue : nullptr),
+      window(window), registry(registry) {}
+
+    [[nodiscard]] PipelineCreator<STATE_INIT_START> begin_pipeline(
+            base_pipeline_info_t pipeline_info = { .use_defaults = true })
+    {
+        if (pipeline_info.use_defaults)
+            pipeline_info = base_pipeline_info_t{};
+        reset_state();
+        _base_pipeline_info = pipeline_info;
+        return { *this };
+    }
+
+    /* A new description starts from nothing, ex: a pipeline described again
+    without tessellation doesn't keep the stages of the previous one. An async
+    creation still uses the old state, it is joined first */
+    void reset_state() {
+        wait_pipeline();
+        _shader_loads.clear();
+        _base_pipeline_info = base_pipeline_info_t{};
+        _vert_info = vert_input_info_t{};
+        _topology_info = topology_info_t{};
+        _viewport_info = viewport_info_t{};
+        _vert_shader_info = vert_shader_info_t{};
+        _tess_info = tess_info_t{ .use_defaults = true };
+        _geom_shader_info = geom_shader_info_t{ .use_defaults = true };
+        _raster_info = rasterizer_info_t{};
+        _msample_info = multisample_info_t{};
+        _blend_info = color_blending_info_t{};
+        _frag_shader_info = frag_shader_info_t{};
+        _depth_info = depth_stencil_info_t{};
+        _layouts_info = layouts_info_t{};
+        _render_pass_info = render_pass_info_t{};
+        base = nullptr;
+    }
+
+    /* Starts from the state of base, the shaders included, and is created as
+    a derivative of it, ex: a wireframe variant only calls add_rasterizer and
+    end_pipeline. base must be started with allow_derivatives and created
+    before this one */
+    [[nodiscard]] PipelineCreator<STATE_INIT_START, true> derive_pipeline(
+            DrawPipeline &base_pipeline)
+    {
+        if (!base_pipeline._base_pipeline_info.allow_derivatives)
+            EXCEPTION("The base pipeline must be started with "
+                    "allow_derivatives");
+        copy_state(base_pipeline);
+        _base_pipeline_info.allow_derivatives = false;
+        base = &base_pipeline;
+        return { *this };
+    }
+
+    /* Makes this the depth pre-pass of material: the same geometry and vertex
+    shader, no fragment stage and no color writes. Draw it first, then draw
+    material with depth_stencil_info_t::get_after_prepass so the fragments
+    are only shaded once. It is a derivative of material when possible, that
+    is when material allows it and is already created, else it is built on
+    it's own (ex: both are created by the same PipelineBatch). */
+    void depth_prepass_of(DrawPipeline &material, bool create_it = true) {
+        copy_state(material);
+        auto render_pass = get_render_pass();
+        if (_render_pass_info.subpass >= render_pass.subpasses.size() ||
+                !render_pass.subpasses[_render_pass_info.subpass].has_depth())
+            EXCEPTION("The pre-pass needs a depth attachment, see "
+                    "RenderPass::add_depth");
+        _depth_info = depth_stencil_info_t{ .depth_only = true };
+        _blend_info = color_blending_info_t{};
+        bool derive = _base_pipeline_info.allow_derivatives &&
+                material.is_ready();
+        _base_pipeline_info.allow_derivatives = false;
+        base = derive ? &material : nullptr;
+        if (create_it)
+            create_pipeline();
+    }
+
+    /* takes the whole state of other, the shaders included. An async
+    creation of other uses the same state, it is joined first, and the
+    pending loads of this one are dropped */
+    void copy_state(DrawPipeline &other) {
+        reset_state();
+        other.wait_pipeline();
+        other.wait_shaders();
+        _base_pipeline_info = other._base_pipeline_info;
+        _vert_info = other._vert_info;
+        _topology_info = other._topology_info;
+        _viewport_info = other._viewport_info;
+        _vert_shader_info = other._vert_shader_info;
+        _tess_info = other._tess_info;
+        _geom_shader_info = other._geom_shader_info;
+        _raster_info = other._raster_info;
+        _msample_info = other._msample_info;
+        _blend_info = other._blend_info;
+        _frag_shader_info = other._frag_shader_info;
+        _depth_info = other._depth_info;
+        _layouts_info = other._layouts_info;
+        _render_pass_info = other._render_pass_info;
+    }
+
+    /* the shader of the stage is loaded on a copy of the info, the pipeline
+    takes the result back when it waits for it in create_pipeline */
+    void start_load(VkShaderStageFlagBits stage, int type) {
+        auto load = [info = *get_stage_info(stage), type]() mutable {
+            pge::load_shader(info, type);
+            return info;
+        };
+        if (_base_pipeline_info.async_shaders)
+            _shader_loads[stage] = get_pipeline_pool().submit(std::move(load));
+        else
+            _shader_loads[stage] = std::async(std::launch::deferred,
+                    std::move(load));
+    }
+
+    shader_info_t *get_stage_info(VkShaderStageFlagBits stage) {
+        switch (stage) {
+            case VK_SHADER_STAGE_VERTEX_BIT: return &_vert_shader_info.info;
+            case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
+                return &_tess_info.control;
+            case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
+                return &_tess_info.evaluation;
+            case VK_SHADER_STAGE_GEOMETRY_BIT: return &_geom_shader_info.info;
+            case VK_SHADER_STAGE_FRAGMENT_BIT: return &_frag_shader_info.info;
+            default: EXCEPTION("Not a stage of a draw pipeline: %x", (int)stage);
+        }
+    }
+
+    /* the topology given to the input assembly, tessellation needs patches */
+    VkPrimitiveTopology get_topology() const {
+        if (!_tess_info.use_defaults)
+            return VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
+        return _topology_info.topology;
+    }
+
+    /* primitive restart isn't allowed with patches, it is left out for them
+    like the topology */
+    bool get_restart_enable() const {
+        return _topology_info.restart_enable &&
+                get_topology() != VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
+    }
+
+    struct stage_t {
+        const shader_info_t *info;
+        VkShaderStageFlagBits stage;
+    };
+
+    /* the shader stages the pipeline is made of, in the pipeline order */
+    std::vector<stage_t> get_stages() const {
+        std::vector<stage_t> stages = {
+            { &_vert_shader_info.info, VK_SHADER_STAGE_VERTEX_BIT },
+        };
+        if (!_tess_info.use_defaults) {
+            stages.push_back({ &_tess_info.control,
+                    VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT });
+            stages.push_back({ &_tess_info.evaluation,
+                    VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT });
+        }
+        if (!_geom_shader_info.use_defaults)
+            stages.push_back({ &_geom_shader_info.info,
+                    VK_SHADER_STAGE_GEOMETRY_BIT });
+        /* a depth pre-pass only needs the positions */
+        if (!_depth_info.depth_only)
+            stages.push_back({ &_frag_shader_info.info,
+                    VK_SHADER_STAGE_FRAGMENT_BIT });
+        return stages;
+    }
+
+    /* blocks until the shaders given to the creator are loaded, rethrows the
+    loading errors */
+    void wait_shaders() {
+        auto wait = [](std::future<shader_info_t>& load, shader_info_t& info) {
+            if (!load.valid())
+                return ;
+            info = load.get();
+            if (!info.get_code_size())
+                EXCEPTION("Failed to load shader %s",
+                        info.path.size() ? info.path : info.name);
+        };
+        for (auto &[stage, load] : _shader_loads)
+            wait(load, *get_stage_info(stage));
+        _shader_loads.clear();
+    }
+
+    /* hash of everything that ends up in the vulkan objects, the shaders must
+    be loaded */
+    uint64_t get_state_hash() const {
+        Hasher h;
+        h.add(_vert_info.binding_desc).add(_vert_info.attr_desc);
+        h.add(get_topology()).add(get_restart_enable());
+
+        /* a dynamic viewport doesn't depend on the extent, so pipelines made
+        for different window sizes are the same */
+        auto &vp = _viewport_info.viewport;
+        h.add(_viewport_info.dynamic);
+        if (!_viewport_info.dynamic) {
+            h.add(vp.x).add(vp.y).add(vp.width).add(vp.height);
+            h.add(_viewport_info.scissor);
+        }
+        h.add(vp.minDepth).add(vp.maxDepth);
+        h.add(get_dynamic_states());
+
+        for (auto &&[info, stage] : get_stages()) {
+            h.add(stage).add(fnv1a_64(info->get_code(), info->get_code_size()));
+            spec_data_t::hash(h, info->spec_constants);
+        }
+        if (!_tess_info.use_defaults)
+            h.add(_tess_info.patch_control_points);
+
+        h.add(_raster_info.depth_clamp).add(_raster_info.raster_discard);
+        h.add(_raster_info.poly_mode).add(_raster_info.cull_face);
+        h.add(_raster_info.front_face).add(_raster_info.line_width);
+        h.add(_msample_info.samples).add(_msample_info.enable_sample_shading);
+        h.add(_msample_info.min_sample_shading);
+        h.add(_depth_info.depth_test).add(_depth_info.depth_write);
+        h.add(_depth_info.compare_op).add(_depth_info.stencil_test);
+        h.add(_depth_info.front).add(_depth_info.back);
+        h.add(_depth_info.depth_only);
+        h.add(_blend_info.enabled);
+        h.add(_layouts_info.desc_layout);
+        h.add(_layouts_info.push_ranges);
+        h.add(_layouts_info.reflect_push_constants);
+
+        h.add(get_render_pass().get_hash()).add(_render_pass_info.subpass);
+        h.add(_base_pipeline_info.allow_derivatives).add(base != nullptr);
+        return h.hash;
+    }
 
-        void state_transition(std::initializer_list<PipelineState> prev_states,
-                PipelineState new_state)
+    std::vector<VkPushConstantRange> get_push_ranges() const {
+        if (_layouts_info.push_ranges.size() ||
+                !_layouts_info.reflect_push_constants)
+            return _layouts_info.push_ranges;
+
+        std::vector<VkPushConstantRange> ranges;
+        auto reflect = [&](const shader_info_t& info,
+                VkShaderStageFlags stage)
         {
-            bool valid_state = false;
-            std::string state_names = "{";
-            bool had_prev = false;
-            for (auto &&state : prev_states) {
-                state_names += (had_prev ? ", " : "") + state_name(state);
-                had_prev = true;
-                if (init_state == state)
-                    valid_state = true;
+            spirv_push_range_t range;
+            std::string err;
+            if (!spirv_reflect_push_constants(info.get_code(),
+                    info.get_code_size() / sizeof(uint32_t), range, &err))
+            {
+                /* a layout without the range would fail at the first push */
+                if (err.size())
+                    EXCEPTION("Can't reflect the push constants of %s: %s, "
+                            "set layouts_info_t::push_ranges",
+                            info.path.size() ? info.path : info.name, err);
+                return ;
             }
-            state_names += "}";
+            /* stages that see the same block share the range */
+            for (auto &r : ranges)
+                if (r.offset == range.offset && r.size == range.size) {
+                    r.stageFlags |= stage;
+                    return ;
+                }
+            ranges.push_back(VkPushConstantRange{
+                .stageFlags = stage,
+                .offset = range.offset,
+                .size = range.size,
+            });
+        };
+        for (auto &&[info, stage] : get_stages())
+            reflect(*info, stage);
+        return ranges;
+    }
+
+    std::vector<VkDynamicState> get_dynamic_states() const {
+        std::vector<VkDynamicState> states;
+        if (_viewport_info.dynamic)
+            states = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        for (auto state : _base_pipeline_info.dynamic_states)
+            if (std::find(states.begin(), states.end(), state) == states.end())
+                states.push_back(state);
+        return states;
+    }
 
-            if (!valid_state)
-                EXCEPTION("Invalid previous state, you must be in one of those "
-                        "states: %s before entering %s state, but you are in "
-                        "state: %s", state_names, state_name(new_state),
-                        state_name(init_state));
-            init_state = new_state;
+    RenderPass get_render_pass() const {
+        if (_render_pass_info.render_pass.attachments.empty())
+            return RenderPass::get_default(window->phydev.surf_fmt.format);
+        return _render_pass_info.render_pass;
+    }
+
+    /* returns false if an identical pipeline was taken from the registry
+    instead of creating a new one */
+    bool create_pipeline() {
+        wait_shaders();
+        if (!registry) {
+            auto data = std::make_shared<PipelineDataScope>(window->d->device);
+            build_pipeline(*data);
+            publish(data);
+            return true;
         }
+        bool created = true;
+        publish(registry->get_or_create(get_state_hash(), [this] {
+            auto data = std::make_shared<PipelineDataScope>(window->d->device);
+            build_pipeline(*data);
+            return data;
+        }, &created));
+        return created;
+    }
 
-        std::string state_name(PipelineState state) {
-            constexpr auto names = magic_enum::enum_names<PipelineState>();
-            for (int i = 0; auto &&name : names) {
-                if (i++ == state)
-                    return std::string(name);
-            }
-            return "UNKNOWN_STATE";
+    /* Creates the pipeline on a worker (get_pipeline_create_pool() if pool is
+    nullptr, a given pool must not be the one the shaders load on). Until it
+    is done get_drawable() gives the fallback, or nullptr to skip the draw.
+    The fallback must be created and outlive this pipeline. A pipeline that
+    is already created keeps drawing with it's current version until the new
+    one is published. wait_pipeline() blocks until it
+    is done and rethrows creation errors. */
+    void create_pipeline_async(DrawPipeline *fallback_pipeline = nullptr,
+            ThreadPool *pool = nullptr)
+    {
+        wait_pipeline();
+        fallback.store(fallback_pipeline, std::memory_order_release);
+        auto &workers = pool ? *pool : get_pipeline_create_pool();
+
+        /* pending before it is queued, a derivative created meanwhile waits
+        for it */
+        auto task = std::make_shared<std::packaged_task<void()>>(
+                [this] { create_pipeline(); });
+        {
+            std::lock_guard<std::mutex> guard(_async_mu);
+            _async_create = task->get_future().share();
         }
+        workers.submit([task] { (*task)(); });
+    }
 
-        void check_init_done() {
-            if (init_state != STATE_INIT_DONE)
-                EXCEPTION("Pipeline initialization not finished, you are in "
-                        "state %s, but should be in %s",
-                        state_name(init_state), state_name(STATE_INIT_DONE));
+    /* safe from any thread. Every waiter sees a creation error, the ones
+    that come after it don't */
+    void wait_pipeline() {
+        std::shared_future<void> pending;
+        {
+            std::lock_guard<std::mutex> guard(_async_mu);
+            pending = _async_create;
         }
-    };
+        if (!pending.valid())
+            return;
+        try {
+            pending.get();
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> guard(_async_mu);
+            _async_create = std::shared_future<void>();
+            throw;
+        }
+    }
 
-    struct PipelineDataScope{
-        PgeWindow *window = nullptr;
-        VkRenderPass render_pass = nullptr;
-        VkPipeline graphic_pipeline = nullptr;
-        VkPipelineLayout pipeline_layout = nullptr;
+    /* a single atomic load, meant for the render thread */
+    bool is_ready() const {
+        return _versions.is_ready();
+    }
 
-        PipelineDataScope(PgeWindow *window) : window(window) {}
+    /* The version to draw with this frame, ours or the fallback's, nullptr
+    if there is none. Loaded once: bind and push with this same version, a
+    version published meanwhile may have other push ranges */
+    const PipelineDataScope *get_drawable() const {
+        if (auto data = get_data())
+            return data;
+        auto fallback_pipeline = fallback.load(std::memory_order_acquire);
+        return fallback_pipeline ? fallback_pipeline->get_drawable() : nullptr;
+    }
 
-        ~PipelineDataScope() {
-            if (graphic_pipeline)
-                vkDestroyPipeline(window->d->device, graphic_pipeline, nullptr);
-            if (render_pass)
-                vkDestroyRenderPass(window->d->device, render_pass, nullptr);
-            if (pipeline_layout)
-                vkDestroyPipelineLayout(window->d->device, pipeline_layout,
-                        nullptr);
-        }
-    };
+    /* binds get_drawable() and returns it for the pushes of the draw, nullptr
+    if there is nothing to draw with */
+    const PipelineDataScope *bind_drawable(VkCommandBuffer cmd,
+            VkExtent2D extent) const
+    {
+        auto drawable = get_drawable();
+        if (drawable)
+            drawable->bind(cmd, extent);
+        return drawable;
+    }
 
-    std::unique_ptr<PipelineDataScope> p = nullptr;
+    const PipelineDataScope *bind_drawable(VkCommandBuffer cmd) const {
+        return bind_drawable(cmd, window->phydev.extent);
+    }
 
-    PgeWindow *window = nullptr;
-    PipelineCreator initer;
+    /* the last version is retired by _versions, not destroyed */
+    ~DrawPipeline() {
+        /* the worker still uses this pipeline, waited for without the lock
+        it may need to finish */
+        std::shared_future<void> pending;
+        {
+            std::lock_guard<std::mutex> guard(_async_mu);
+            pending = std::move(_async_create);
+        }
+        if (pending.valid())
+            pending.wait();
+    }
 
-    DrawPipeline(PgeWindow *window) : window(window), initer(*this) {
-        p = std::make_unique<PipelineDataScope>(window);
+    /* the version the render thread draws with, see PipelineVersions */
+    PipelineDataScope *get_data() const {
+        return _versions.get();
     }
 
-    PipelineCreator::Scope begin_pipeline() {
-        /* note: destructor of scope is not called here */
-        PipelineCreator::Scope scope(initer);
-        scope->start_pipeline();
-        return scope;
+    /* the old version goes to the retire queue of the window, see
+    PipelineVersions */
+    void publish(std::shared_ptr<PipelineDataScope> data) {
+        _versions.publish(std::move(data));
     }
 
-    void create_pipeline() {
+    /* All the create infos of one pipeline, they point to each other so they
+    are kept at a fixed address until vkCreateGraphicsPipelines is called */
+    struct build_t {
+        VkPipelineVertexInputStateCreateInfo vert_input_cfg;
+        VkPipelineInputAssemblyStateCreateInfo topol_cfg;
+        VkViewport viewport_cfg;
+        VkRect2D scissor_cfg;
+        VkPipelineViewportStateCreateInfo viewport_state_cfg;
+        std::vector<std::shared_ptr<ShaderModuleScope>> modules;
+        std::vector<std::unique_ptr<spec_data_t>> spec_data;
+        std::vector<VkPipelineShaderStageCreateInfo> shader_stages;
+        VkPipelineTessellationStateCreateInfo tess_cfg;
+        VkPipelineRasterizationStateCreateInfo rasterizer_cfg;
+        VkPipelineMultisampleStateCreateInfo multisampler_cfg;
+        VkPipelineDepthStencilStateCreateInfo depth_stencil_cfg;
+        std::vector<VkPipelineColorBlendAttachmentState> color_blend_attachments;
+        VkPipelineColorBlendStateCreateInfo blending_cfg;
+        std::vector<VkDynamicState> dynamic_states;
+        VkPipelineDynamicStateCreateInfo dynamic_cfg;
+        VkGraphicsPipelineCreateInfo pipeline_cfg;
+
+        build_t() {}
+        build_t(const build_t&) = delete;
+        build_t& operator = (const build_t&) = delete;
+    };
+
+    void build_pipeline(PipelineDataScope &data) {
+        auto b = prepare_build(data);
+        if (vkCreateGraphicsPipelines(window->d->device,
+                window->d->pipeline_cache, 1,
+                &b->pipeline_cfg, nullptr, &data.graphic_pipeline) != VK_SUCCESS)
+            EXCEPTION("failed to create graphics pipeline!");
+    }
+
+    /* The create infos of the described state, without the device: the
+    shader modules, the layout, the render pass and the base are left empty
+    for prepare_build. The shaders must be loaded. */
+    std::unique_ptr<build_t> describe_build() {
+        auto b = std::make_unique<build_t>();
+
         /* Input bindings */
-        VkPipelineVertexInputStateCreateInfo vert_input_cfg{
+        b->vert_input_cfg = VkPipelineVertexInputStateCreateInfo{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
             .vertexBindingDescriptionCount =
                 (uint32_t)_vert_info.binding_desc.size(),
@@ -405,63 +1527,52 @@ struct DrawPipeline {
         };
 
         /* Topology */
-        VkPipelineInputAssemblyStateCreateInfo topol_cfg = {
+        b->topol_cfg = VkPipelineInputAssemblyStateCreateInfo{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-            .topology = _topology_info.topology,
-            .primitiveRestartEnable = _topology_info.restart_enable,
+            .topology = get_topology(),
+            .primitiveRestartEnable = get_restart_enable(),
         };
 
         /* Viewport */
-        VkViewport viewport_cfg = _viewport_info.viewport;
-        VkRect2D scissor_cfg = _viewport_info.scissor;
-        VkPipelineViewportStateCreateInfo viewport_state_cfg{
+        b->viewport_cfg = _viewport_info.viewport;
+        b->scissor_cfg = _viewport_info.scissor;
+        b->viewport_state_cfg = VkPipelineViewportStateCreateInfo{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
             .viewportCount = 1,
-            .pViewports = &viewport_cfg,
+            .pViewports = _viewport_info.dynamic ? nullptr : &b->viewport_cfg,
             .scissorCount = 1,
-            .pScissors = &scissor_cfg,
+            .pScissors = _viewport_info.dynamic ? nullptr : &b->scissor_cfg,
         };
 
-        /* Vertex shader stage */
-        VkShaderModuleCreateInfo sh_vert_info{
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = _vert_shader_info.info.bytecode.size() * sizeof(uint32_t),
-            .pCode = _vert_shader_info.info.bytecode.data(),
-        };
-        VkShaderModule vert_module;
-        if (vkCreateShaderModule(window->d->device, &sh_vert_info, nullptr,
-                &vert_module) != VK_SUCCESS)
-            EXCEPTION("failed to create shader module!");
-        VkPipelineShaderStageCreateInfo vertex_stage{
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .stage = VK_SHADER_STAGE_VERTEX_BIT,
-            .module = vert_module,
-            .pName = "main",
+        /* Dynamic state */
+        b->dynamic_states = get_dynamic_states();
+        b->dynamic_cfg = VkPipelineDynamicStateCreateInfo{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+            .dynamicStateCount = (uint32_t)b->dynamic_states.size(),
+            .pDynamicStates = b->dynamic_states.data(),
         };
 
-        /* Fragment shader stage */
-        VkShaderModuleCreateInfo sh_frag_info{
-            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = _frag_shader_info.info.bytecode.size() * sizeof(uint32_t),
-            .pCode = _frag_shader_info.info.bytecode.data(),
-        };
-        VkShaderModule frag_module;
-        if (vkCreateShaderModule(window->d->device, &sh_frag_info, nullptr,
-                &frag_module) != VK_SUCCESS)
-            EXCEPTION("failed to create shader module!");
-        VkPipelineShaderStageCreateInfo frag_stage{
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-            .module = frag_module,
-            .pName = "main",
-        };
+        /* Shader stages, the modules are added by prepare_build */
+        for (auto &&[info, stage] : get_stages()) {
+            b->spec_data.push_back(
+                    std::make_unique<spec_data_t>(info->spec_constants));
+            b->shader_stages.push_back(VkPipelineShaderStageCreateInfo{
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = stage,
+                .module = VK_NULL_HANDLE,
+                .pName = "main",
+                .pSpecializationInfo = b->spec_data.back()->get(),
+            });
+        }
 
-        VkPipelineShaderStageCreateInfo shader_stages[] = {
-            vertex_stage, frag_stage
+        /* Tessellation */
+        b->tess_cfg = VkPipelineTessellationStateCreateInfo{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO,
+            .patchControlPoints = _tess_info.patch_control_points,
         };
 
         /* Rasterizer */
-        VkPipelineRasterizationStateCreateInfo rasterizer_cfg{
+        b->rasterizer_cfg = VkPipelineRasterizationStateCreateInfo{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
             .depthClampEnable = _raster_info.depth_clamp,
             .rasterizerDiscardEnable = _raster_info.raster_discard,
@@ -476,7 +1587,7 @@ struct DrawPipeline {
         };
 
         // Multisampler
-        VkPipelineMultisampleStateCreateInfo multisampler_cfg{
+        b->multisampler_cfg = VkPipelineMultisampleStateCreateInfo{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
             .rasterizationSamples = _msample_info.samples,
             .sampleShadingEnable = _msample_info.enable_sample_shading,
@@ -486,7 +1597,30 @@ struct DrawPipeline {
             .alphaToOneEnable = VK_FALSE, // Optiona,
         };
 
-        // Blending
+        RenderPass render_pass = get_render_pass();
+        if (_render_pass_info.subpass >= render_pass.subpasses.size())
+            EXCEPTION("The render pass has no subpass %d",
+                    _render_pass_info.subpass);
+        auto &&subpass = render_pass.subpasses[_render_pass_info.subpass];
+        if (_depth_info.depth_only && !subpass.has_depth())
+            EXCEPTION("A depth only pipeline needs a depth attachment in "
+                    "subpass %d", _render_pass_info.subpass);
+
+        // Depth and stencil
+        b->depth_stencil_cfg = VkPipelineDepthStencilStateCreateInfo{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+            .depthTestEnable = _depth_info.depth_test,
+            .depthWriteEnable = _depth_info.depth_write,
+            .depthCompareOp = _depth_info.compare_op,
+            .depthBoundsTestEnable = VK_FALSE,
+            .stencilTestEnable = _depth_info.stencil_test,
+            .front = _depth_info.front,
+            .back = _depth_info.back,
+            .minDepthBounds = 0.0f,
+            .maxDepthBounds = 1.0f,
+        };
+
+        // Blending, the same for every color attachment of the subpass
         VkPipelineColorBlendAttachmentState color_blend_attachment{
             .blendEnable = _blend_info.enabled,
             .srcColorBlendFactor = VK_BLEND_FACTOR_ONE, // Optional
@@ -495,108 +1629,312 @@ struct DrawPipeline {
             .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE, // Optional
             .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO, // Optional
             .alphaBlendOp = VK_BLEND_OP_ADD, // Optional
-            .colorWriteMask =
+            .colorWriteMask = _depth_info.depth_only ? 0u :
                     VK_COLOR_COMPONENT_R_BIT |
                     VK_COLOR_COMPONENT_G_BIT |
                     VK_COLOR_COMPONENT_B_BIT |
                     VK_COLOR_COMPONENT_A_BIT,
         };
-        VkPipelineColorBlendStateCreateInfo blending_cfg{
+        b->color_blend_attachments.assign(subpass.color_refs.size(),
+                color_blend_attachment);
+        b->blending_cfg = VkPipelineColorBlendStateCreateInfo{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
             .logicOpEnable = _blend_info.enabled,
             .logicOp = VK_LOGIC_OP_COPY, // Optional
-            .attachmentCount = 1,
-            .pAttachments = &color_blend_attachment,
+            .attachmentCount = (uint32_t)b->color_blend_attachments.size(),
+            .pAttachments = b->color_blend_attachments.data(),
             .blendConstants = { 0.0f, 0.0f, 0.0f, 0.0f },
         };
 
+        b->pipeline_cfg = VkGraphicsPipelineCreateInfo{
+            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .stageCount = (uint32_t)b->shader_stages.size(),
+            .pStages = b->shader_stages.data(),
+            .pVertexInputState = &b->vert_input_cfg,
+            .pInputAssemblyState = &b->topol_cfg,
+            .pTessellationState = _tess_info.use_defaults ? nullptr :
+                    &b->tess_cfg,
+            .pViewportState = &b->viewport_state_cfg,
+            .pRasterizationState = &b->rasterizer_cfg,
+            .pMultisampleState = &b->multisampler_cfg,
+            .pDepthStencilState = subpass.has_depth() ?
+                    &b->depth_stencil_cfg : nullptr,
+            .pColorBlendState = &b->blending_cfg,
+            .pDynamicState = b->dynamic_states.empty() ? nullptr :
+                    &b->dynamic_cfg,
+            .layout = VK_NULL_HANDLE,
+            .renderPass = VK_NULL_HANDLE,
+            .subpass = _render_pass_info.subpass,
+            .basePipelineHandle = VK_NULL_HANDLE, // Optional
+            .basePipelineIndex = -1, // Optional
+        };
+        if (_base_pipeline_info.allow_derivatives)
+            b->pipeline_cfg.flags |= VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+        return b;
+    }
+
+    /* creates the layout and gets the render pass and the shader modules of
+    data, the pipeline itself is left to the caller. The shaders must be
+    loaded. base_index is the index of the base in the same
+    vkCreateGraphicsPipelines call, -1 if the base is already created */
+    std::unique_ptr<build_t> prepare_build(PipelineDataScope &data,
+            int32_t base_index = -1)
+    {
+        auto &&features = window->phydev.features;
+        if (!_tess_info.use_defaults && !features.tessellationShader)
+            EXCEPTION("The device doesn't support tessellation shaders");
+        if (!_geom_shader_info.use_defaults && !features.geometryShader)
+            EXCEPTION("The device doesn't support geometry shaders");
+
+        auto b = describe_build();
+
+        /* Shader stages, the modules come from the registry if there is one,
+        else they only live until the pipeline is created */
+        auto get_module = [this](const shader_info_t& info) {
+            if (registry)
+                return registry->shader_modules.get(window, info);
+            return std::make_shared<ShaderModuleScope>(window, info);
+        };
+        for (size_t i = 0; auto &&[info, stage] : get_stages()) {
+            b->modules.push_back(get_module(*info));
+            b->shader_stages[i++].module = b->modules.back()->module;
+        }
+
+        data.dynamic_viewport = _viewport_info.dynamic;
+        data.min_depth = _viewport_info.viewport.minDepth;
+        data.max_depth = _viewport_info.viewport.maxDepth;
+
         // Layouts
+        data.push_ranges = get_push_ranges();
         VkPipelineLayoutCreateInfo pipeline_layout_info_cfg{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
             .setLayoutCount = (uint32_t)_layouts_info.desc_layout.size(),
             .pSetLayouts = _layouts_info.desc_layout.data(),
-            .pushConstantRangeCount = 0,
-            .pPushConstantRanges = nullptr,
+            .pushConstantRangeCount = (uint32_t)data.push_ranges.size(),
+            .pPushConstantRanges = data.push_ranges.data(),
         };
 
         if (vkCreatePipelineLayout(window->d->device, &pipeline_layout_info_cfg,
-                nullptr, &p->pipeline_layout) != VK_SUCCESS)
+                nullptr, &data.pipeline_layout) != VK_SUCCESS)
             EXCEPTION("failed to create pipeline layout!");
 
-        // TODO: Make render pass non-fixed
-
-        VkAttachmentDescription color_attacment {
-            .format = window->phydev.surf_fmt.format,
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-        };
+        // Render pass, shared with the other users of the same description
+        auto render_pass = get_render_pass();
+        if (registry)
+            data.render_pass_ref = registry->render_passes.get(window,
+                    render_pass);
+        else
+            data.render_pass_ref = std::make_shared<RenderPassScope>(window,
+                    render_pass);
+        data.render_pass = data.render_pass_ref->render_pass;
+        b->pipeline_cfg.layout = data.pipeline_layout;
+        b->pipeline_cfg.renderPass = data.render_pass;
+
+        // Derivatives
+        if (base) {
+            b->pipeline_cfg.flags |= VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+            if (base_index >= 0) {
+                b->pipeline_cfg.basePipelineIndex = base_index;
+                return b;
+            }
+            base->wait_pipeline();
+            if (!base->is_ready())
+                EXCEPTION("The base pipeline must be created before it's "
+                        "derivatives");
+            b->pipeline_cfg.basePipelineHandle =
+                    base->get_data()->graphic_pipeline;
+        }
+        return b;
+    }
+};
 
-        VkAttachmentReference color_attacment_ref{
-            .attachment = 0,
-            .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        };
+/* Creates many pipelines at once, for when a level loads. The pipelines are
+described with end_pipeline(false) and must belong to the same window. With
+BATCH_SINGLE_CALL all of them go to the driver in one vkCreateGraphicsPipelines
+call, with BATCH_THREADS each one is created on a worker, the window's pipeline
+cache being safe to share between threads. Pipelines found in their registry
+are reused in both modes. A derivative can be in the same batch as it's base,
+the bases are created first. */
+struct PipelineBatch {
+    enum Mode {
+        BATCH_SINGLE_CALL,
+        BATCH_THREADS,
+    };
 
-        VkSubpassDescription subpass{
-            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-            .colorAttachmentCount = 1,
-            .pColorAttachments = &color_attacment_ref,
-        };
+    struct timing_t {
+        DrawPipeline *pipeline;
+        uint64_t shader_wait_us;    // waiting for the async shader loads
+        uint64_t create_us;         // for BATCH_SINGLE_CALL, the whole call
+        bool reused;                // shared with a pipeline of the registry
+    };
 
-        VkSubpassDependency dependency{
-            .srcSubpass = VK_SUBPASS_EXTERNAL,
-            .dstSubpass = 0,
-            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            .srcAccessMask = 0,
-            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        };
+    std::vector<DrawPipeline *> pipelines;
+    std::vector<timing_t> timings;  // filled by create(), same order as add()
 
-        VkRenderPassCreateInfo render_pass_info{
-            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-            .attachmentCount = 1,
-            .pAttachments = &color_attacment,
-            .subpassCount = 1,
-            .pSubpasses = &subpass,
-            .dependencyCount = 1,
-            .pDependencies = &dependency,
-        };
+    void add(DrawPipeline *pipeline) {
+        if (pipelines.size() && pipelines[0]->window != pipeline->window)
+            EXCEPTION("All the pipelines of a batch must use the same window");
+        pipelines.push_back(pipeline);
+    }
 
-        if (vkCreateRenderPass(window->d->device, &render_pass_info, nullptr,
-                &p->render_pass) != VK_SUCCESS)
-        {
-            EXCEPTION("failed to create render pass!");
+    /* pool defaults to get_pipeline_pool() */
+    void create(Mode mode = BATCH_THREADS, ThreadPool *pool = nullptr) {
+        timings.clear();
+
+        /* the shaders are waited for here, so the workers never block on
+        loads that are queued behind them */
+        for (auto pipeline : pipelines) {
+            TimePointUs wait_time;
+            pipeline->wait_shaders();
+            timings.push_back(timing_t{
+                .pipeline = pipeline,
+                .shader_wait_us = wait_time.elapsed(),
+            });
         }
 
-        VkGraphicsPipelineCreateInfo pipeline_cfg{
-            .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-            .stageCount = 2,
-            .pStages = shader_stages,
-            .pVertexInputState = &vert_input_cfg,
-            .pInputAssemblyState = &topol_cfg,
-            .pViewportState = &viewport_state_cfg,
-            .pRasterizationState = &rasterizer_cfg,
-            .pMultisampleState = &multisampler_cfg,
-            .pDepthStencilState = nullptr,
-            .pColorBlendState = &blending_cfg,
-            .pDynamicState = nullptr,
-            .layout = p->pipeline_layout,
-            .renderPass = p->render_pass,
-            .subpass = 0,
-            .basePipelineHandle = VK_NULL_HANDLE, // Optional
-            .basePipelineIndex = -1, // Optional
-        };
+        if (mode == BATCH_SINGLE_CALL)
+            create_single_call();
+        else
+            create_threads(pool ? *pool : get_pipeline_pool());
+    }
 
-        if (vkCreateGraphicsPipelines(window->d->device, VK_NULL_HANDLE, 1,
-                &pipeline_cfg, nullptr, &p->graphic_pipeline) != VK_SUCCESS)
-            EXCEPTION("failed to create graphics pipeline!");
+    void print_timings() {
+        for (size_t i = 0; auto &&t : timings)
+            DBG("pipeline %ld: shaders: %ld us, create: %ld us%s", i++,
+                    t.shader_wait_us, t.create_us, t.reused ? " (reused)" : "");
+    }
+
+private:
+    /* the index of the pipeline's base in the batch, SIZE_MAX if it has no
+    base or the base isn't part of the batch */
+    size_t get_base_index(size_t i) const {
+        auto base = pipelines[i]->base;
+        auto it = std::find(pipelines.begin(), pipelines.end(), base);
+        if (!base || it == pipelines.end())
+            return SIZE_MAX;
+        return it - pipelines.begin();
+    }
+
+    /* the pipelines that aren't derivatives of the batch first, then the
+    derivatives, so every base comes before it's derivatives */
+    std::vector<size_t> get_order() const {
+        std::vector<size_t> order;
+        for (bool derived : {false, true})
+            for (size_t i = 0; i < pipelines.size(); i++)
+                if ((get_base_index(i) != SIZE_MAX) == derived)
+                    order.push_back(i);
+        return order;
+    }
+
+    /* the derivatives of the batch wait for their bases to be published */
+    void create_threads(ThreadPool& pool) {
+        std::vector<timing_t *> bases, derivatives;
+        for (size_t i = 0; i < timings.size(); i++) {
+            auto &wave = get_base_index(i) == SIZE_MAX ? bases : derivatives;
+            wave.push_back(&timings[i]);
+        }
+        create_wave(pool, bases);
+        create_wave(pool, derivatives);
+    }
 
-        vkDestroyShaderModule(window->d->device, frag_module, nullptr);
-        vkDestroyShaderModule(window->d->device, vert_module, nullptr);
+    void create_wave(ThreadPool& pool, const std::vector<timing_t *>& wave) {
+        std::vector<std::future<void>> done;
+        for (auto t : wave)
+            done.push_back(pool.submit([t] {
+                TimePointUs create_time;
+                t->reused = !t->pipeline->create_pipeline();
+                t->create_us = create_time.elapsed();
+            }));
+
+        /* every task must be finished before rethrowing, they use timings */
+        std::exception_ptr err;
+        for (auto &&d : done) {
+            try {
+                d.get();
+            }
+            catch (...) {
+                if (!err)
+                    err = std::current_exception();
+            }
+        }
+        if (err)
+            std::rethrow_exception(err);
+    }
+
+    void create_single_call() {
+        struct new_pipeline_t {
+            uint64_t hash;
+            std::shared_ptr<PipelineDataScope> data;
+            std::unique_ptr<DrawPipeline::build_t> build;
+        };
+        std::vector<new_pipeline_t> created;
+        std::vector<size_t> owner(pipelines.size());    // index in created
+        std::map<uint64_t, size_t> batch_hashes;
+
+        for (size_t i : get_order()) {
+            auto pipeline = pipelines[i];
+            uint64_t hash = 0;
+            if (pipeline->registry) {
+                hash = pipeline->get_state_hash();
+                if (auto data = pipeline->registry->find(hash)) {
+                    pipeline->publish(data);
+                    timings[i].reused = true;
+                    owner[i] = SIZE_MAX;
+                    continue;
+                }
+                auto it = batch_hashes.find(hash);
+                if (it != batch_hashes.end()) {
+                    timings[i].reused = true;
+                    owner[i] = it->second;
+                    continue;
+                }
+                batch_hashes[hash] = created.size();
+            }
+            auto data = std::make_shared<PipelineDataScope>(
+                    pipeline->window->d->device);
+
+            /* a base of the batch that isn't reused is created by the same
+            call, before this one */
+            size_t base_i = get_base_index(i);
+            int32_t base_index = -1;
+            if (base_i != SIZE_MAX && owner[base_i] != SIZE_MAX)
+                base_index = owner[base_i];
+            auto build = pipeline->prepare_build(*data, base_index);
+            owner[i] = created.size();
+            created.push_back(new_pipeline_t{ hash, data, std::move(build) });
+        }
+        if (created.empty())
+            return ;
+
+        std::vector<VkGraphicsPipelineCreateInfo> infos;
+        for (auto &&c : created)
+            infos.push_back(c.build->pipeline_cfg);
+        std::vector<VkPipeline> handles(created.size(), VK_NULL_HANDLE);
+
+        auto window = pipelines[0]->window;
+        TimePointUs create_time;
+        VkResult res = vkCreateGraphicsPipelines(window->d->device,
+                window->d->pipeline_cache, (uint32_t)infos.size(),
+                infos.data(), nullptr, handles.data());
+        uint64_t create_us = create_time.elapsed();
+
+        /* the ones that were created are destroyed with their data on error */
+        for (size_t i = 0; i < created.size(); i++)
+            created[i].data->graphic_pipeline = handles[i];
+        if (res != VK_SUCCESS)
+            EXCEPTION("failed to create graphics pipelines!");
+
+        for (size_t i = 0; i < pipelines.size(); i++) {
+            if (owner[i] == SIZE_MAX)
+                continue;
+            auto &c = created[owner[i]];
+            timings[i].create_us = create_us;
+            if (pipelines[i]->registry)
+                pipelines[i]->publish(pipelines[i]->registry->get_or_create(
+                        c.hash, [&c] { return c.data; }));
+            else
+                pipelines[i]->publish(c.data);
+        }
     }
 };
 }
@@ -0,0 +1,82 @@
+#ifndef PGE_PIPELINE_CACHE_H
+#define PGE_PIPELINE_CACHE_H
+
+#include <vulkan/vulkan.h>
+#include <cstring>
+#include <vector>
+
+#include "utils.h"
+
+namespace pge
+{
+
+/* A saved pipeline cache is only usable on the exact driver and device that
+produced it. The driver should reject a foreign blob by itself, but not all of
+them do it gracefully, so the header is checked before handing it over. */
+inline bool pipeline_cache_valid(const void *data, size_t size,
+        const VkPhysicalDeviceProperties& props)
+{
+    VkPipelineCacheHeaderVersionOne header;
+    if (!data || size < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.headerSize < sizeof(header) || header.headerSize > size)
+        return false;
+    if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+        return false;
+    if (header.vendorID != props.vendorID || header.deviceID != props.deviceID)
+        return false;
+    return memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID,
+            VK_UUID_SIZE) == 0;
+}
+
+/* Creates a pipeline cache seeded from path. A missing or stale file gives an
+empty cache, the file is simply replaced at the next save. */
+inline VkPipelineCache load_pipeline_cache(VkDevice device,
+        const VkPhysicalDeviceProperties& props, const std::string& path)
+{
+    MappedFile file;
+    VkPipelineCacheCreateInfo cache_info{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    };
+    if (path.size() && file.map(path)) {
+        if (pipeline_cache_valid(file.data, file.size, props)) {
+            cache_info.initialDataSize = file.size;
+            cache_info.pInitialData = file.data;
+        }
+        else
+            DBG("Dropping stale pipeline cache: %s", path);
+    }
+
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    VkResult res = vkCreatePipelineCache(device, &cache_info, nullptr, &cache);
+    if (res != VK_SUCCESS && cache_info.pInitialData) {
+        DBG("Driver refused pipeline cache: %s, starting empty", path);
+        cache_info.initialDataSize = 0;
+        cache_info.pInitialData = nullptr;
+        res = vkCreatePipelineCache(device, &cache_info, nullptr, &cache);
+    }
+    if (res != VK_SUCCESS)
+        EXCEPTION("failed to create pipeline cache!");
+    return cache;
+}
+
+inline bool save_pipeline_cache(VkDevice device, VkPipelineCache cache,
+        const std::string& path)
+{
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS)
+        return false;
+    std::vector<uint8_t> data(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+        return false;
+    if (!write_file_atomic(path, data.data(), size)) {
+        DBG("Couldn't save the pipeline cache to: %s", path);
+        return false;
+    }
+    return true;
+}
+
+} // namespace pge
+
+#endif
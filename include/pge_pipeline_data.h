@@ -0,0 +1,603 @@
+#ifndef PGE_PIPELINE_DATA_H
+#define PGE_PIPELINE_DATA_H
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <deque>
+
+#include "utils.h"
+
+/* The parts of the pipelines that don't need a window or a device: the render
+pass descriptions, the order of the pipeline stages, the published versions of
+a pipeline and the split of the pushes. Kept apart so they can be tested on
+their own (make test_pipeline) */
+
+namespace pge
+{
+
+inline VkImageAspectFlags get_format_aspect(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+        case VK_FORMAT_D32_SFLOAT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT;
+        case VK_FORMAT_S8_UINT:
+            return VK_IMAGE_ASPECT_STENCIL_BIT;
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        default:
+            return VK_IMAGE_ASPECT_COLOR_BIT;
+    }
+}
+
+struct attachment_info_t {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    VkAttachmentLoadOp load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    VkAttachmentStoreOp store_op = VK_ATTACHMENT_STORE_OP_STORE;
+    VkAttachmentLoadOp stencil_load_op = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    VkAttachmentStoreOp stencil_store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImageLayout final_layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    /* the attachment only lives inside the render pass (ex: a G-buffer read
+    by a later subpass), it can't be stored and it's image is made by
+    FramebufferScope with lazily allocated memory */
+    VkBool32 transient = VK_FALSE;
+};
+
+/* The attachments a subpass uses, as indexes in RenderPass::attachments.
+input_refs are the attachments written by previous subpasses and read with
+subpassLoad, preserve_refs the ones a later subpass needs but this one
+doesn't touch. depth_ref is VK_ATTACHMENT_UNUSED when there is no depth. */
+struct render_subpass_info_t {
+    std::vector<VkAttachmentReference> color_refs;
+    std::vector<VkAttachmentReference> input_refs;
+    std::vector<uint32_t> preserve_refs;
+    VkAttachmentReference depth_ref = {
+        .attachment = VK_ATTACHMENT_UNUSED,
+        .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    bool has_depth() const {
+        return depth_ref.attachment != VK_ATTACHMENT_UNUSED;
+    }
+};
+
+/* Description of a render pass: the attachments, the subpasses that use them
+and the dependencies between subpasses. Two equal descriptions give the same
+VkRenderPass when they go through a RenderPassCache. */
+struct RenderPass {
+    std::vector<attachment_info_t> attachments;
+    std::vector<render_subpass_info_t> subpasses;
+    std::vector<VkSubpassDependency> dependencies;
+
+    /* the one pipelines used to hardcode: a single color attachment that is
+    cleared, stored and presented */
+    static RenderPass get_default(VkFormat format) {
+        return RenderPass{
+            .attachments = { attachment_info_t{ .format = format } },
+            .subpasses = { render_subpass_info_t{
+                .color_refs = { VkAttachmentReference{
+                    .attachment = 0,
+                    .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                }},
+            }},
+            .dependencies = { VkSubpassDependency{
+                .srcSubpass = VK_SUBPASS_EXTERNAL,
+                .dstSubpass = 0,
+                .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                .srcAccessMask = 0,
+                .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            }},
+        };
+    }
+
+    /* G-buffer and lighting in the same render pass: subpass 0 writes the
+    transient gbuffer attachments (1..n), subpass 1 reads them as input
+    attachments and writes the presented color attachment 0. The G-buffer
+    doesn't leave the tile memory on the GPUs that have one. */
+    static RenderPass get_deferred(VkFormat format,
+            const std::vector<VkFormat>& gbuffer)
+    {
+        RenderPass ret = get_default(format);
+        ret.subpasses.clear();
+        ret.dependencies.clear();
+
+        render_subpass_info_t geometry, lighting;
+        for (auto gbuf_format : gbuffer) {
+            uint32_t index = ret.attachments.size();
+            ret.attachments.push_back(attachment_info_t{
+                .format = gbuf_format,
+                .store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+                .final_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                .transient = VK_TRUE,
+            });
+            geometry.color_refs.push_back(VkAttachmentReference{
+                .attachment = index,
+                .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            });
+            lighting.input_refs.push_back(VkAttachmentReference{
+                .attachment = index,
+                .layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            });
+        }
+        lighting.color_refs.push_back(VkAttachmentReference{
+            .attachment = 0,
+            .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        });
+        ret.subpasses = { geometry, lighting };
+
+        for (uint32_t subpass : {0, 1})
+            ret.dependencies.push_back(VkSubpassDependency{
+                .srcSubpass = VK_SUBPASS_EXTERNAL,
+                .dstSubpass = subpass,
+                .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                .srcAccessMask = 0,
+                .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            });
+        ret.dependencies.push_back(VkSubpassDependency{
+            .srcSubpass = 0,
+            .dstSubpass = 1,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+            .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
+        });
+        return ret;
+    }
+
+    /* adds a depth attachment used by every subpass, it is cleared at the
+    start of the render pass. A transient depth never leaves the render pass,
+    keep it if a later pass samples it (ex: shadow maps) */
+    RenderPass& add_depth(VkFormat depth_format, bool transient = true) {
+        bool stencil = get_format_aspect(depth_format) &
+                VK_IMAGE_ASPECT_STENCIL_BIT;
+        auto store_op = transient ? VK_ATTACHMENT_STORE_OP_DONT_CARE :
+                VK_ATTACHMENT_STORE_OP_STORE;
+        uint32_t index = attachments.size();
+        attachments.push_back(attachment_info_t{
+            .format = depth_format,
+            .store_op = store_op,
+            .stencil_load_op = stencil ? VK_ATTACHMENT_LOAD_OP_CLEAR :
+                    VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .stencil_store_op = stencil ? store_op :
+                    VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .final_layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            .transient = transient,
+        });
+        for (auto &subpass : subpasses)
+            subpass.depth_ref = VkAttachmentReference{
+                .attachment = index,
+                .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            };
+
+        /* the depth writes before a dependency (the previous frame, a
+        pre-pass) are made visible to the tests after it, like the color
+        attachments */
+        for (auto &dep : dependencies) {
+            dep.srcStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                    VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            dep.dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                    VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            dep.srcAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            dep.dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        }
+        return *this;
+    }
+
+    uint64_t get_hash() const {
+        Hasher h;
+        h.add(attachments);
+        h.add(subpasses.size());
+        for (auto &&subpass : subpasses) {
+            h.add(subpass.color_refs);
+            h.add(subpass.input_refs);
+            h.add(subpass.preserve_refs);
+            h.add(subpass.depth_ref);
+        }
+        h.add(dependencies);
+        return h.hash;
+    }
+
+    /* how the subpasses use the image of the attachment */
+    VkImageUsageFlags get_usage(uint32_t attachment) const {
+        VkImageUsageFlags usage = 0;
+        auto uses = [&](const std::vector<VkAttachmentReference>& refs) {
+            return std::any_of(refs.begin(), refs.end(), [&](auto &&ref) {
+                return ref.attachment == attachment;
+            });
+        };
+        for (auto &&subpass : subpasses) {
+            if (uses(subpass.color_refs))
+                usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+            if (uses(subpass.input_refs))
+                usage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+            if (subpass.depth_ref.attachment == attachment)
+                usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        }
+        /* transient is only valid together with an attachment usage */
+        if (usage && attachments[attachment].transient)
+            usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        return usage;
+    }
+
+    VkRenderPass create(VkDevice device) const {
+        std::vector<VkAttachmentDescription> attachment_descs;
+        for (auto &&att : attachments) {
+            if (att.transient && att.store_op == VK_ATTACHMENT_STORE_OP_STORE)
+                EXCEPTION("A transient attachment can't be stored");
+            attachment_descs.push_back(VkAttachmentDescription{
+                .format = att.format,
+                .samples = att.samples,
+                .loadOp = att.load_op,
+                .storeOp = att.store_op,
+                .stencilLoadOp = att.stencil_load_op,
+                .stencilStoreOp = att.stencil_store_op,
+                .initialLayout = att.initial_layout,
+                .finalLayout = att.final_layout,
+            });
+        }
+
+        std::vector<VkSubpassDescription> subpass_descs;
+        for (auto &&subpass : subpasses)
+            subpass_descs.push_back(VkSubpassDescription{
+                .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+                .inputAttachmentCount = (uint32_t)subpass.input_refs.size(),
+                .pInputAttachments = subpass.input_refs.data(),
+                .colorAttachmentCount = (uint32_t)subpass.color_refs.size(),
+                .pColorAttachments = subpass.color_refs.data(),
+                .pDepthStencilAttachment = subpass.has_depth() ?
+                        &subpass.depth_ref : nullptr,
+                .preserveAttachmentCount =
+                        (uint32_t)subpass.preserve_refs.size(),
+                .pPreserveAttachments = subpass.preserve_refs.data(),
+            });
+
+        VkRenderPassCreateInfo render_pass_info{
+            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+            .attachmentCount = (uint32_t)attachment_descs.size(),
+            .pAttachments = attachment_descs.data(),
+            .subpassCount = (uint32_t)subpass_descs.size(),
+            .pSubpasses = subpass_descs.data(),
+            .dependencyCount = (uint32_t)dependencies.size(),
+            .pDependencies = dependencies.data(),
+        };
+
+        VkRenderPass render_pass;
+        if (vkCreateRenderPass(device, &render_pass_info, nullptr,
+                &render_pass) != VK_SUCCESS)
+        {
+            EXCEPTION("failed to create render pass!");
+        }
+        return render_pass;
+    }
+};
+
+/* owns the VkRenderPass, see pge_pipeline.h */
+struct RenderPassScope;
+
+/* The stages of DrawPipeline::PipelineCreator, in the order they must be
+given */
+enum PipelineState {
+    STATE_INIT_START,
+    STATE_VERTEX_INPUT,
+    STATE_INPUT_ASSEMBLY,
+    STATE_VIEWPORT,
+    STATE_VERTEX_SHADER,
+    STATE_TESSELLATION,         // optional
+    STATE_GEOMETRY_SHADER,      // optional
+    STATE_RASTERIZER,
+    STATE_MULTISAMPLER,
+    STATE_FRAGMENT_SHADER,
+    STATE_DEPTH_STENCIL,
+    STATE_COLOR_BLENDING,
+    STATE_LAYOUTS,
+    STATE_RENDER_PASS,
+    STATE_INIT_DONE,
+};
+
+constexpr bool pipeline_state_optional(PipelineState state) {
+    return state == STATE_TESSELLATION || state == STATE_GEOMETRY_SHADER;
+}
+
+/* A pipeline goes through every state but the optional ones. A derived
+pipeline keeps the state of it's base for the stages it skips, so it only has
+to keep the order. */
+constexpr bool pipeline_can_enter(PipelineState from, PipelineState to,
+        bool derived)
+{
+    if (to <= from)
+        return false;
+    if (derived)
+        return true;
+    for (int state = from + 1; state < to; state++)
+        if (!pipeline_state_optional(PipelineState(state)))
+            return false;
+    return true;
+}
+
+/* One version of a pipeline, with the state needed to record draws with it.
+The render thread loads it once per draw and uses only it, so a version
+published meanwhile can't mix with it */
+struct PipelineDataScope {
+    VkDevice device = nullptr;
+    VkRenderPass render_pass = nullptr;     // owned by render_pass_ref
+    VkPipeline graphic_pipeline = nullptr;
+    VkPipelineLayout pipeline_layout = nullptr;
+    std::shared_ptr<RenderPassScope> render_pass_ref;
+    std::vector<VkPushConstantRange> push_ranges;   // the layout's
+
+    /* the viewport is set by bind() when it is dynamic */
+    bool dynamic_viewport = false;
+    float min_depth = 0.0f;
+    float max_depth = 1.0f;
+
+    PipelineDataScope(VkDevice device) : device(device) {}
+
+    /* binds the pipeline and sets the dynamic viewport and scissor to cover
+    extent, the other dynamic states are left to the caller */
+    void bind(VkCommandBuffer cmd, VkExtent2D extent) const {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                graphic_pipeline);
+        if (!dynamic_viewport)
+            return ;
+        VkViewport viewport{
+            .x = 0.0f,
+            .y = 0.0f,
+            .width = (float)extent.width,
+            .height = (float)extent.height,
+            .minDepth = min_depth,
+            .maxDepth = max_depth,
+        };
+        VkRect2D scissor{
+            .offset = {0, 0},
+            .extent = extent,
+        };
+        vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+    }
+
+    /* records the push of value at offset. The push is split where the
+    ranges start or end, each part goes to exactly the stages whose range
+    holds it, as vkCmdPushConstants wants */
+    template <typename T>
+    void push_constants(VkCommandBuffer cmd, const T& value,
+            uint32_t offset = 0) const;
+
+    ~PipelineDataScope() {
+        if (graphic_pipeline)
+            vkDestroyPipeline(device, graphic_pipeline, nullptr);
+        if (pipeline_layout)
+            vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+    }
+};
+
+/* The pipeline versions replaced by DrawPipeline::publish, the command
+buffers in flight may still use them. Each one is tagged with the frame being
+recorded when it was replaced and destroyed once that frame is done. Owned by
+the window, that drives it from it's frame fences: begin_frame() before
+recording frame n, frame_completed(n) when the fence of frame n signaled.
+Frames must complete in order. The window clears it once the device is idle,
+before the device is destroyed. */
+struct RetireQueue {
+    using data_ptr_t = std::shared_ptr<PipelineDataScope>;
+
+    void begin_frame(uint64_t frame) {
+        std::lock_guard<std::mutex> guard(mu);
+        curr_frame = frame;
+    }
+
+    void retire(data_ptr_t data) {
+        std::lock_guard<std::mutex> guard(mu);
+        retired.push_back({ curr_frame, std::move(data) });
+    }
+
+    /* destroys the versions retired up to frame */
+    void frame_completed(uint64_t frame) {
+        std::vector<data_ptr_t> done;   // destroyed outside of the lock
+        {
+            std::lock_guard<std::mutex> guard(mu);
+            while (retired.size() && retired.front().first <= frame) {
+                done.push_back(std::move(retired.front().second));
+                retired.pop_front();
+            }
+        }
+    }
+
+    /* destroys everything, the device must be idle */
+    void clear() {
+        std::lock_guard<std::mutex> guard(mu);
+        retired.clear();
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> guard(mu);
+        return retired.size();
+    }
+
+private:
+    std::mutex mu;
+    uint64_t curr_frame = 0;
+    std::deque<std::pair<uint64_t, data_ptr_t>> retired;
+};
+
+/* The version a pipeline draws with. Replaced as a whole by publish(), so it
+is read with get() while a new version is made. Not copyable, the readers
+hold it's address. The old versions go to retire_queue, without one they are
+destroyed as soon as they are replaced, that is only right when no command
+buffer can use them */
+struct PipelineVersions {
+    PipelineVersions(RetireQueue *retire_queue = nullptr)
+    : retire_queue(retire_queue) {}
+    PipelineVersions(const PipelineVersions&) = delete;
+    PipelineVersions& operator = (const PipelineVersions&) = delete;
+
+    /* a single atomic load, meant for the render thread */
+    bool is_ready() const {
+        return _ready.load(std::memory_order_acquire);
+    }
+
+    /* the version the render thread draws with, no lock and no reference
+    count. It stays valid until the frame it is recorded in completes, see
+    RetireQueue */
+    PipelineDataScope *get() const {
+        return p.load(std::memory_order_acquire);
+    }
+
+    /* Replaces the vulkan objects in one atomic store, readers see either the
+    old or the new version, both complete. The old one goes to the
+    retire queue instead of being destroyed. */
+    void publish(std::shared_ptr<PipelineDataScope> data) {
+        std::shared_ptr<PipelineDataScope> old;
+        {
+            std::lock_guard<std::mutex> guard(publish_mu);
+            p.store(data.get(), std::memory_order_release);
+            old = std::exchange(_owned, std::move(data));
+        }
+        if (old && retire_queue)
+            retire_queue->retire(std::move(old));
+        _ready.store(true, std::memory_order_release);
+    }
+
+    /* the command buffers in flight may still use the last version */
+    ~PipelineVersions() {
+        if (_owned && retire_queue)
+            retire_queue->retire(std::move(_owned));
+    }
+
+private:
+    RetireQueue *retire_queue = nullptr;
+    std::atomic<PipelineDataScope *> p = nullptr;
+    static_assert(std::atomic<PipelineDataScope *>::is_always_lock_free);
+
+    /* owns *p, shared with the other pipelines of the registry that have the
+    same state. Only the writers touch it */
+    std::mutex publish_mu;
+    std::shared_ptr<PipelineDataScope> _owned;
+    std::atomic<bool> _ready = false;
+};
+
+/* The most push constant ranges split_push handles. Reflection gives one per
+stage (at most 5 for a graphic pipeline), ranges given by hand can be more */
+#ifndef PGE_MAX_PUSH_RANGES
+# define PGE_MAX_PUSH_RANGES 8
+#endif
+
+/* the parts of a push, see split_push */
+struct push_parts_t {
+    static constexpr uint32_t max_cnt = 2 * PGE_MAX_PUSH_RANGES + 1;
+
+    VkPushConstantRange parts[max_cnt];
+    uint32_t cnt = 0;
+
+    const VkPushConstantRange *begin() const { return parts; }
+    const VkPushConstantRange *end() const { return parts + cnt; }
+};
+
+/* Splits the push of [offset, offset + size) at the edges of the ranges, the
+stages of a part are the ones of all the ranges that hold it. Throws if a byte
+isn't in any range. Doesn't allocate, it runs for every push. */
+inline push_parts_t split_push(const std::vector<VkPushConstantRange>& ranges,
+        uint32_t offset, uint32_t size)
+{
+    if (offset % 4 || size % 4)
+        EXCEPTION("Push constant offset %d and size %d must be multiples of 4",
+                offset, size);
+    if (ranges.size() > PGE_MAX_PUSH_RANGES)
+        EXCEPTION("More than %d push constant ranges", PGE_MAX_PUSH_RANGES);
+
+    /* usually a single range, or ranges that all hold the whole push: one
+    part with all their stages */
+    uint32_t end = offset + size;
+    VkShaderStageFlags stages = 0;
+    bool partial = false;
+    for (auto &&r : ranges) {
+        if (r.offset >= end || r.offset + r.size <= offset)
+            continue;
+        if (r.offset <= offset && end <= r.offset + r.size)
+            stages |= r.stageFlags;
+        else
+            partial = true;
+    }
+    push_parts_t ret;
+    if (!partial) {
+        if (!stages)
+            EXCEPTION("No push constant range covers offset %d, size %d",
+                    offset, size);
+        ret.parts[ret.cnt++] = VkPushConstantRange{
+            .stageFlags = stages,
+            .offset = offset,
+            .size = size,
+        };
+        return ret;
+    }
+
+    /* sorted edges, inserted in place, there are only a few */
+    uint32_t edges[push_parts_t::max_cnt + 1] = { offset, end };
+    uint32_t edge_cnt = 2;
+    auto add_edge = [&](uint32_t edge) {
+        if (edge <= offset || edge >= end)
+            return ;
+        uint32_t i = 1;
+        while (edges[i] < edge)     // stops at end at the latest
+            i++;
+        if (edges[i] == edge)
+            return ;
+        for (uint32_t j = edge_cnt; j > i; j--)
+            edges[j] = edges[j - 1];
+        edges[i] = edge;
+        edge_cnt++;
+    };
+    for (auto &&r : ranges) {
+        add_edge(r.offset);
+        add_edge(r.offset + r.size);
+    }
+
+    for (uint32_t i = 0; i + 1 < edge_cnt; i++) {
+        VkShaderStageFlags part_stages = 0;
+        for (auto &&r : ranges)
+            if (r.offset <= edges[i] && edges[i + 1] <= r.offset + r.size)
+                part_stages |= r.stageFlags;
+        if (!part_stages)
+            EXCEPTION("No push constant range covers offset %d, size %d",
+                    edges[i], edges[i + 1] - edges[i]);
+        if (ret.cnt && ret.parts[ret.cnt - 1].stageFlags == part_stages)
+            ret.parts[ret.cnt - 1].size += edges[i + 1] - edges[i];
+        else
+            ret.parts[ret.cnt++] = VkPushConstantRange{
+                .stageFlags = part_stages,
+                .offset = edges[i],
+                .size = edges[i + 1] - edges[i],
+            };
+    }
+    return ret;
+}
+
+/* after split_push, it needs it */
+template <typename T>
+void PipelineDataScope::push_constants(VkCommandBuffer cmd, const T& value,
+        uint32_t offset) const
+{
+    static_assert(std::is_trivially_copyable_v<T>,
+            "push constants are copied as raw bytes");
+    static_assert(sizeof(T) % 4 == 0,
+            "push constant sizes are multiples of 4");
+    auto bytes = reinterpret_cast<const uint8_t *>(&value);
+    for (auto &&part : split_push(push_ranges, offset, sizeof(T)))
+        vkCmdPushConstants(cmd, pipeline_layout, part.stageFlags,
+                part.offset, part.size, bytes + part.offset - offset);
+}
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef PGE_SHADER_PACK_H
+#define PGE_SHADER_PACK_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "utils.h"
+
+/* A shader pack is a single file holding many SPIR-V blobs, built offline by
+`make shaders` and memory-mapped at runtime, so no shader is compiled or copied
+when the game loads. Every blob is checked against it's content_hash when the
+pack is opened. Layout:
+    - shader_pack_header_t
+    - entry_cnt x shader_pack_entry_t, sorted by name_hash
+    - the blobs, each one aligned to SHADER_PACK_ALIGN bytes
+*/
+
+namespace pge
+{
+
+constexpr uint32_t SHADER_PACK_MAGIC = 0x53454750; // "PGES"
+constexpr uint32_t SHADER_PACK_VERSION = 1;
+constexpr uint64_t SHADER_PACK_ALIGN = 64;
+
+struct shader_pack_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_cnt;
+    uint32_t reserved;
+};
+
+struct shader_pack_entry_t {
+    uint64_t name_hash;     // fnv1a_64 of the shader name
+    uint64_t content_hash;  // fnv1a_64 of the blob
+    uint64_t offset;        // from the start of the file
+    uint64_t size;          // in bytes
+};
+
+inline uint64_t shader_pack_align(uint64_t offset) {
+    return (offset + SHADER_PACK_ALIGN - 1) / SHADER_PACK_ALIGN *
+            SHADER_PACK_ALIGN;
+}
+
+struct ShaderPack {
+    MappedFile file;
+    const shader_pack_header_t *header = nullptr;
+    const shader_pack_entry_t *entries = nullptr;
+
+    ShaderPack(const std::string& path) {
+        if (!file.map(path))
+            EXCEPTION("Can't map shader pack: %s", path.c_str());
+        if (file.size < sizeof(shader_pack_header_t))
+            EXCEPTION("Shader pack too small: %s", path.c_str());
+
+        header = (const shader_pack_header_t *)file.data;
+        if (header->magic != SHADER_PACK_MAGIC ||
+                header->version != SHADER_PACK_VERSION)
+            EXCEPTION("Invalid shader pack header, magic: %x version: %d",
+                    header->magic, header->version);
+
+        uint64_t toc_end = sizeof(shader_pack_header_t) +
+                header->entry_cnt * sizeof(shader_pack_entry_t);
+        if (toc_end > file.size)
+            EXCEPTION("Shader pack table of contents out of bounds");
+        entries = (const shader_pack_entry_t *)(header + 1);
+
+        for (uint32_t i = 0; i < header->entry_cnt; i++) {
+            auto &entry = entries[i];
+            if (entry.offset < toc_end || entry.offset % sizeof(uint32_t) ||
+                    entry.size % sizeof(uint32_t) ||
+                    entry.offset > file.size ||
+                    entry.size > file.size - entry.offset)
+                EXCEPTION("Shader pack entry %d out of bounds", i);
+            if (fnv1a_64(get_code(&entry), entry.size) != entry.content_hash)
+                EXCEPTION("Shader pack entry %d is corrupted, the content "
+                        "hash doesn't match: %s", i, path.c_str());
+        }
+    }
+
+    /* returns nullptr if there is no shader with that name */
+    const shader_pack_entry_t *find(const std::string& name) const {
+        uint64_t name_hash = fnv1a_64(name);
+        auto end = entries + header->entry_cnt;
+        auto it = std::lower_bound(entries, end, name_hash,
+                [](const shader_pack_entry_t& entry, uint64_t hash) {
+                    return entry.name_hash < hash;
+                });
+        if (it == end || it->name_hash != name_hash)
+            return nullptr;
+        return it;
+    }
+
+    const uint32_t *get_code(const shader_pack_entry_t *entry) const {
+        return (const uint32_t *)((const uint8_t *)file.data + entry->offset);
+    }
+
+    size_t size() const { return header->entry_cnt; }
+};
+
+}
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef PGE_SPIRV_H
+#define PGE_SPIRV_H
+
+#include <memory>
+#include <string>
+#include <map>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+#include "utils.h"
+
+/* Helpers for SPIR-V binaries that don't need vulkan or shaderc */
+
+namespace pge
+{
+
+constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+constexpr uint32_t SPIRV_HEADER_WORDS = 5;
+
+/* checks the module header: magic, version and that there is at least one
+instruction worth of words, returns false and sets err on failure */
+inline bool spirv_validate(const uint32_t *code, size_t word_cnt,
+        std::string *err = nullptr)
+{
+    auto fail = [&](const std::string& msg) {
+        if (err)
+            *err = msg;
+        return false;
+    };
+    if (!code || word_cnt <= SPIRV_HEADER_WORDS)
+        return fail(sformat("module too small: %ld words", word_cnt));
+    if ((uintptr_t)code % sizeof(uint32_t))
+        return fail("module not aligned to 4 bytes");
+    if (code[0] == __builtin_bswap32(SPIRV_MAGIC))
+        return fail("module has the wrong endianness");
+    if (code[0] != SPIRV_MAGIC)
+        return fail(sformat("invalid magic: %x", code[0]));
+
+    /* version is 0 | major | minor | 0 */
+    uint32_t major = (code[1] >> 16) & 0xff;
+    uint32_t minor = (code[1] >> 8) & 0xff;
+    if ((code[1] & 0xff0000ff) || major != 1 || minor > 6)
+        return fail(sformat("unsupported version: %d.%d", major, minor));
+    if (code[3] == 0)
+        return fail("invalid id bound: 0");
+    return true;
+}
+
+/* The bytes of the push constant block used by a module */
+struct spirv_push_range_t {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+};
+
+/* Finds the push constant block of the module, the range goes from the first
+to the end of the last member the module declares. Returns false if the module
+has no push constants, or if a member's type can't be sized, in which case err
+is set. A bool takes 4 bytes, like in the std430 layout. */
+inline bool spirv_reflect_push_constants(const uint32_t *code, size_t word_cnt,
+        spirv_push_range_t& range, std::string *err = nullptr)
+{
+    enum {
+        OP_TYPE_BOOL = 20, OP_TYPE_INT = 21, OP_TYPE_FLOAT = 22, OP_TYPE_VECTOR = 23,
+        OP_TYPE_MATRIX = 24, OP_TYPE_ARRAY = 28, OP_TYPE_STRUCT = 30,
+        OP_TYPE_POINTER = 32, OP_CONSTANT = 43, OP_VARIABLE = 59,
+        OP_DECORATE = 71, OP_MEMBER_DECORATE = 72,
+        DEC_ARRAY_STRIDE = 6, DEC_MATRIX_STRIDE = 7, DEC_OFFSET = 35,
+        STORAGE_PUSH_CONSTANT = 9,
+    };
+    struct type_t {
+        uint32_t op = 0;
+        std::vector<uint32_t> args;     // the operands after the result id
+    };
+    std::map<uint32_t, type_t> types;
+    std::map<uint32_t, uint32_t> constants;
+    std::map<uint32_t, uint32_t> array_strides;
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> member_offsets;
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> matrix_strides;
+    uint32_t block_ptr = 0;
+
+    if (!spirv_validate(code, word_cnt))
+        return false;
+    for (size_t i = SPIRV_HEADER_WORDS; i < word_cnt;) {
+        uint32_t op = code[i] & 0xffff;
+        uint32_t len = code[i] >> 16;
+        if (len == 0 || i + len > word_cnt)
+            return false;
+        const uint32_t *w = code + i + 1;
+        switch (op) {
+            case OP_TYPE_BOOL: case OP_TYPE_INT: case OP_TYPE_FLOAT:
+            case OP_TYPE_VECTOR: case OP_TYPE_MATRIX: case OP_TYPE_ARRAY:
+            case OP_TYPE_STRUCT: case OP_TYPE_POINTER:
+                types[w[0]] = type_t{ op, {w + 1, w + len - 1} };
+                break;
+            case OP_CONSTANT:
+                if (len >= 4)
+                    constants[w[1]] = w[2];
+                break;
+            case OP_VARIABLE:
+                if (len >= 4 && w[2] == STORAGE_PUSH_CONSTANT)
+                    block_ptr = w[0];
+                break;
+            case OP_DECORATE:
+                if (len >= 4 && w[1] == DEC_ARRAY_STRIDE)
+                    array_strides[w[0]] = w[2];
+                break;
+            case OP_MEMBER_DECORATE:
+                if (len >= 5 && w[2] == DEC_OFFSET)
+                    member_offsets[{w[0], w[1]}] = w[3];
+                if (len >= 5 && w[2] == DEC_MATRIX_STRIDE)
+                    matrix_strides[{w[0], w[1]}] = w[3];
+                break;
+        }
+        i += len;
+    }
+
+    if (!block_ptr || !types.count(block_ptr) ||
+            types[block_ptr].op != OP_TYPE_POINTER)
+        return false;
+
+    /* size in bytes of a type inside the block, 0 if unknown */
+    std::function<uint32_t(uint32_t, uint32_t)> type_size =
+            [&](uint32_t id, uint32_t matrix_stride) -> uint32_t
+    {
+        auto it = types.find(id);
+        if (it == types.end())
+            return 0;
+        auto &t = it->second;
+        switch (t.op) {
+            case OP_TYPE_BOOL:
+                return 4;
+            case OP_TYPE_INT: case OP_TYPE_FLOAT:
+                return t.args[0] / 8;
+            case OP_TYPE_VECTOR:
+                return t.args[1] * type_size(t.args[0], 0);
+            case OP_TYPE_MATRIX:
+                if (matrix_stride)
+                    return t.args[1] * matrix_stride;
+                return t.args[1] * type_size(t.args[0], 0);
+            case OP_TYPE_ARRAY:
+                if (!array_strides.count(id) || !constants.count(t.args[1]))
+                    return 0;
+                return array_strides[id] * constants[t.args[1]];
+            case OP_TYPE_STRUCT: {
+                uint32_t end = 0;
+                for (uint32_t m = 0; m < t.args.size(); m++) {
+                    uint32_t size = type_size(t.args[m],
+                            matrix_strides.count({id, m}) ?
+                            matrix_strides[{id, m}] : 0);
+                    if (!size || !member_offsets.count({id, m}))
+                        return 0;
+                    end = std::max(end, member_offsets[{id, m}] + size);
+                }
+                return end;
+            }
+        }
+        return 0;
+    };
+
+    uint32_t block = types[block_ptr].args[1];
+    if (!types.count(block) || types[block].op != OP_TYPE_STRUCT ||
+            types[block].args.empty() || !type_size(block, 0))
+    {
+        if (err)
+            *err = "the push constant block has a member that can't be sized";
+        return false;
+    }
+    range.offset = UINT32_MAX;
+    for (uint32_t m = 0; m < types[block].args.size(); m++)
+        range.offset = std::min(range.offset, member_offsets[{block, m}]);
+    range.size = type_size(block, 0) - range.offset;
+    return true;
+}
+
+/* The workgroup size of a compute module, from it's LocalSize execution mode.
+Returns false if there is none or if a constant decorated with the
+WorkgroupSize built-in overrides it. glslang emits that constant for
+local_size_x_id (with a placeholder LocalSize of 1 1 1), so the real size is
+only known once the specialization constants are set. */
+inline bool spirv_reflect_local_size(const uint32_t *code, size_t word_cnt,
+        uint32_t local_size[3])
+{
+    enum {
+        OP_EXECUTION_MODE = 16, OP_DECORATE = 71,
+        MODE_LOCAL_SIZE = 17, DEC_BUILT_IN = 11, BUILT_IN_WORKGROUP_SIZE = 25,
+    };
+
+    if (!spirv_validate(code, word_cnt))
+        return false;
+    bool found = false;
+    for (size_t i = SPIRV_HEADER_WORDS; i < word_cnt;) {
+        uint32_t op = code[i] & 0xffff;
+        uint32_t len = code[i] >> 16;
+        if (len == 0 || i + len > word_cnt)
+            return false;
+        const uint32_t *w = code + i + 1;
+        if (op == OP_EXECUTION_MODE && len >= 6 && w[1] == MODE_LOCAL_SIZE) {
+            for (int k = 0; k < 3; k++)
+                local_size[k] = w[2 + k];
+            found = true;
+        }
+        /* the decorations come after the execution modes */
+        if (op == OP_DECORATE && len >= 4 && w[1] == DEC_BUILT_IN &&
+                w[2] == BUILT_IN_WORKGROUP_SIZE)
+            return false;
+        i += len;
+    }
+    return found;
+}
+
+/* A .spv file mapped in memory, copies share the mapping, so it lives as long
+as the last copy */
+struct spirv_view_t {
+    std::shared_ptr<MappedFile> file;
+    const uint32_t *code = nullptr;
+    size_t word_cnt = 0;
+};
+
+inline spirv_view_t spirv_map_file(const std::string& path) {
+    spirv_view_t view{ .file = std::make_shared<MappedFile>(path) };
+    if (!view.file->data)
+        EXCEPTION("Can't map SPIR-V file: %s", path.c_str());
+    if (view.file->size % sizeof(uint32_t))
+        EXCEPTION("SPIR-V file %s size is not a multiple of 4: %ld",
+                path.c_str(), view.file->size);
+
+    view.code = (const uint32_t *)view.file->data;
+    view.word_cnt = view.file->size / sizeof(uint32_t);
+    std::string err;
+    if (!spirv_validate(view.code, view.word_cnt, &err))
+        EXCEPTION("Invalid SPIR-V file %s: %s", path.c_str(), err);
+    return view;
+}
+
+}
+
+#endif
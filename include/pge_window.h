@@ -4,13 +4,36 @@
 #include <functional>
 #include <set>
 
-#include "glfw_vulkan_if.h"
+/* Inside the engine the config and the game library come from
+game_engine_st.h. Without it (ex: the tests) the config is plain json and no
+game library is loaded */
+#if __has_include("game_engine_st.h")
+# include "glfw_vulkan_if.h"
+# include "game_engine_st.h"
+# include "pge_common.h"
+# define PGE_WINDOW_GAME_LIB 1
+#else
+# include <vulkan/vulkan.h>
+# include <GLFW/glfw3.h>
+# include "json.h"
+using Config = nlohmann::json;
+# define JSTR(cfg, name) ((cfg)[(name)].get_ref<const std::string&>().c_str())
+# define JINT(cfg, name) ((cfg)[(name)].get<int>())
+# define JBOOL(cfg, name) ((cfg)[(name)].get<bool>())
+#endif
+
 #include "utils.h"
-#include "game_engine_st.h"
-#include "pge_common.h"
+#include "pge_pipeline_cache.h"
+#include "pge_pipeline_data.h"
 
 #define MIN_DBG_SEVERITY VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
 
+/* the frames the cpu records while the gpu works on the previous ones, each
+one has a fence, see Window::begin_frame() */
+#ifndef PGE_FRAMES_IN_FLIGHT
+# define PGE_FRAMES_IN_FLIGHT 2
+#endif
+
 #define SCOPED_VAR(name, type, deleter, init_val)\
     std::function<void(type *)> name ## _deleter = deleter;\
     std::unique_ptr<type, decltype(name ## _deleter)> name = init_val;
@@ -21,7 +44,9 @@ namespace pge
 
 struct GlfwIniter {
     GlfwIniter(const Config& cfg) {
+#ifdef PGE_WINDOW_GAME_LIB
         pge::init(JSTR(cfg, "libgame_path"));
+#endif
         if (!glfwInit())
             EXCEPTION("Failed to init glfw");
     }
@@ -36,6 +61,9 @@ game engine as they are only configuring normal stuff. Maybe later on, some
 options should be added for some of the initialization values, but anything
 more seems like a huge waste of time.
     Everything will be destroyed at window destruction.
+    With "headless" in the config there is no glfw window, surface or
+swapchain, only the device, ex: for the tests that render offscreen. The
+extent is then the width and height of the config.
 */
 struct Window {
     struct dev_t {
@@ -43,6 +71,7 @@ struct Window {
         int score;
         uint32_t graphic_index;
         uint32_t presentation_index;
+        uint32_t compute_index;
         VkSurfaceCapabilitiesKHR capab;
         VkSurfaceFormatKHR surf_fmt;
         VkPresentModeKHR surf_pres;
@@ -50,6 +79,12 @@ struct Window {
         uint32_t swch_img_cnt;
         VkQueue graphic_queue;
         VkQueue present_queue;
+        VkQueue compute_queue;
+        VkPhysicalDeviceProperties props;
+
+        /* the features enabled on the logical device, a pipeline stage that
+        needs one that is off can't be created */
+        VkPhysicalDeviceFeatures features;
     };
 
     struct WindowDataScope {
@@ -60,12 +95,30 @@ struct Window {
         VkDevice device = nullptr;
         VkSwapchainKHR swapchain = nullptr;
         std::vector<VkImageView> swap_img_views;
+        VkPipelineCache pipeline_cache = nullptr;
+        std::string pipeline_cache_path;   // empty if it isn't saved
+
+        /* the pipeline versions replaced while frames were in flight, they
+        are destroyed as the frame fences signal */
+        RetireQueue retire_queue;
+        std::vector<VkFence> frame_fences;
+        uint64_t frame = 0;
 
         ~WindowDataScope() {
             if (device)
                 vkDeviceWaitIdle(device);
 
-            
+            /* nothing is in flight anymore, the retired pipelines go before
+            the cache they were created with and the device */
+            retire_queue.clear();
+            for (auto fence : frame_fences)
+                vkDestroyFence(device, fence, nullptr);
+            if (pipeline_cache) {
+                if (pipeline_cache_path.size())
+                    save_pipeline_cache(device, pipeline_cache,
+                            pipeline_cache_path);
+                vkDestroyPipelineCache(device, pipeline_cache, nullptr);
+            }
             for (auto img_view : swap_img_views)
                 vkDestroyImageView(device, img_view, nullptr);
             if (swapchain)
@@ -83,28 +136,33 @@ struct Window {
         }
     };
     std::unique_ptr<WindowDataScope> d;
-    dev_t dev;
+    dev_t phydev;
 
     Window(const Config& cfg) {
-        /* initialize glfw */
         d = std::make_unique<WindowDataScope>();
-        static GlfwIniter glfw_initer(cfg);
-
-        /* create glfw window */
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-        d->window = glfwCreateWindow(JINT(cfg, "width"), JINT(cfg, "height"),
-                JSTR(cfg, "window_name"), nullptr, nullptr);
-        if (!d->window)
-            EXCEPTION("Can't create glfw window");
-        glfwSetInputMode(d->window, GLFW_STICKY_KEYS, GLFW_TRUE);
+        bool headless = cfg.contains("headless") && JBOOL(cfg, "headless");
+
+        if (!headless) {
+            /* initialize glfw */
+            static GlfwIniter glfw_initer(cfg);
+
+            /* create glfw window */
+            glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+            glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+            d->window = glfwCreateWindow(JINT(cfg, "width"),
+                    JINT(cfg, "height"), JSTR(cfg, "window_name"),
+                    nullptr, nullptr);
+            if (!d->window)
+                EXCEPTION("Can't create glfw window");
+            glfwSetInputMode(d->window, GLFW_STICKY_KEYS, GLFW_TRUE);
+        }
 
         bool debug_mode = JBOOL(cfg, "debug_mode");
         if (debug_mode && check_dbg_support() == false)
             EXCEPTION("Can't add validation layers");
 
         /* get required instance extensions */
-        auto req_exts = get_required_inst_extensions();
+        auto req_exts = get_required_inst_extensions(headless);
 
         /* create vulkan instance */
         VkApplicationInfo app_info{
@@ -145,33 +203,43 @@ struct Window {
             EXCEPTION("failed to set up debug messenger!");
 
         /* create window surface */
-        if (glfwCreateWindowSurface(d->instance, d->window,
+        if (!headless && glfwCreateWindowSurface(d->instance, d->window,
                 nullptr, &d->surface)!= VK_SUCCESS)
     		EXCEPTION("failed to create window surface!");
         
         /* select a physical device */
-        dev = select_phy_dev();
+        phydev = select_phy_dev();
+        if (headless)
+            phydev.extent = VkExtent2D{
+                    uint32_t(JINT(cfg, "width")), uint32_t(JINT(cfg, "height")) };
+
+        /* compute work goes on the graphic queue, unless async_compute asks
+        for a compute only family, that runs next to the rendering */
+        bool async_compute = cfg.contains("async_compute") &&
+                JBOOL(cfg, "async_compute");
+        phydev.compute_index = select_compute_index(phydev.phy_dev,
+                phydev.graphic_index, async_compute);
 
         VkSwapchainCreateInfoKHR swapchain_info{
             .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
             .surface = d->surface,
-            .minImageCount = dev.swch_img_cnt,
-            .imageFormat = dev.surf_fmt.format,
-            .imageColorSpace = dev.surf_fmt.colorSpace,
-            .imageExtent = dev.extent,
+            .minImageCount = phydev.swch_img_cnt,
+            .imageFormat = phydev.surf_fmt.format,
+            .imageColorSpace = phydev.surf_fmt.colorSpace,
+            .imageExtent = phydev.extent,
             .imageArrayLayers = 1,
             .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-            .preTransform = dev.capab.currentTransform,
+            .preTransform = phydev.capab.currentTransform,
             .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-            .presentMode = dev.surf_pres,
+            .presentMode = phydev.surf_pres,
             .clipped = VK_TRUE,
             .oldSwapchain = VK_NULL_HANDLE,
         };
 
         // TODO: Find why when praphic == pres, we use exclusive
         uint32_t queue_indices[] = {
-                dev.graphic_index, dev.presentation_index };
-        if (dev.graphic_index != dev.presentation_index) {
+                phydev.graphic_index, phydev.presentation_index };
+        if (phydev.graphic_index != phydev.presentation_index) {
             swapchain_info.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
             swapchain_info.queueFamilyIndexCount = 2;
             swapchain_info.pQueueFamilyIndices = queue_indices;
@@ -183,8 +251,8 @@ struct Window {
 
         float que_priority = 1.0f;
         std::vector<VkDeviceQueueCreateInfo> que_infos;
-        std::set<uint32_t> unique_que_indexes{
-                dev.graphic_index, dev.presentation_index };
+        std::set<uint32_t> unique_que_indexes{ phydev.graphic_index,
+                phydev.presentation_index, phydev.compute_index };
         for (uint32_t que_index : unique_que_indexes) {
             que_infos.push_back(VkDeviceQueueCreateInfo{
                 .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
@@ -194,10 +262,18 @@ struct Window {
             });
         }
 
-        // for now, we don't use any feature
-        VkPhysicalDeviceFeatures dev_features{};
+        /* the optional pipeline stages, when the device has them */
+        VkPhysicalDeviceFeatures supported;
+        vkGetPhysicalDeviceFeatures(phydev.phy_dev, &supported);
+        VkPhysicalDeviceFeatures dev_features{
+            .geometryShader = supported.geometryShader,
+            .tessellationShader = supported.tessellationShader,
+        };
+        phydev.features = dev_features;
 
-        std::vector<const char*> dev_exts = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+        std::vector<const char*> dev_exts;
+        if (!headless)
+            dev_exts.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
         VkDeviceCreateInfo dev_info{
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
             .queueCreateInfoCount = uint32_t(que_infos.size()),
@@ -210,62 +286,106 @@ struct Window {
         };
 
         /* create de logical device */
-        if (vkCreateDevice(dev.phy_dev, &dev_info, NULL,
+        if (vkCreateDevice(phydev.phy_dev, &dev_info, NULL,
                 &d->device) != VK_SUCCESS)
             EXCEPTION("failed to create logical device!");
 
-        if (vkCreateSwapchainKHR(d->device, &swapchain_info, nullptr,
-                &d->swapchain) != VK_SUCCESS)
+        if (!headless && vkCreateSwapchainKHR(d->device, &swapchain_info,
+                nullptr, &d->swapchain) != VK_SUCCESS)
         {
             EXCEPTION("failed to create swap chain!");
         }
 
-        /* get queues for logical device */
-        vkGetDeviceQueue(d->device, dev.graphic_index, 0,
-                &dev.graphic_queue);
-        vkGetDeviceQueue(d->device, dev.presentation_index, 0,
-                &dev.present_queue);
+        /* used by all the pipelines of this window, the driver skips the
+        compilation of the pipelines it finds inside */
+        if (cfg.contains("pipeline_cache_path"))
+            d->pipeline_cache_path = JSTR(cfg, "pipeline_cache_path");
+        d->pipeline_cache = load_pipeline_cache(d->device, phydev.props,
+                d->pipeline_cache_path);
+
+        /* signaled, the first frames have nothing to wait for */
+        VkFenceCreateInfo fence_info{
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+        };
+        d->frame_fences.resize(PGE_FRAMES_IN_FLIGHT, nullptr);
+        for (auto &fence : d->frame_fences)
+            if (vkCreateFence(d->device, &fence_info, nullptr,
+                    &fence) != VK_SUCCESS)
+                EXCEPTION("failed to create frame fence!");
 
-        /* create swap images views */
-        uint32_t cnt = 0;
-        vkGetSwapchainImagesKHR(d->device, d->swapchain, &cnt, nullptr);
-
-        std::vector<VkImage> swap_imgs(cnt);
-        vkGetSwapchainImagesKHR(d->device, d->swapchain, &cnt, swap_imgs.data());
-
-        d->swap_img_views.resize(swap_imgs.size());
-
-        for (size_t i = 0; i < swap_imgs.size(); i++) {
-            VkImageViewCreateInfo view_info{
-                .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-                .image = swap_imgs[i],
-                .viewType = VK_IMAGE_VIEW_TYPE_2D,
-                .format = dev.surf_fmt.format,
-                .components = {
-                    .r = VK_COMPONENT_SWIZZLE_IDENTITY,
-                    .g = VK_COMPONENT_SWIZZLE_IDENTITY,
-                    .b = VK_COMPONENT_SWIZZLE_IDENTITY,
-                    .a = VK_COMPONENT_SWIZZLE_IDENTITY,
-                },
-                .subresourceRange = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .baseMipLevel = 0,
-                    .levelCount = 1,
-                    .baseArrayLayer = 0,
-                    .layerCount = 1,
-                },
-            };
-            if (vkCreateImageView(d->device, &view_info, nullptr,
-                    &d->swap_img_views[i]) != VK_SUCCESS)
-            {
-                EXCEPTION("failed to create image views!");
+        /* get queues for logical device */
+        vkGetDeviceQueue(d->device, phydev.graphic_index, 0,
+                &phydev.graphic_queue);
+        vkGetDeviceQueue(d->device, phydev.presentation_index, 0,
+                &phydev.present_queue);
+        vkGetDeviceQueue(d->device, phydev.compute_index, 0,
+                &phydev.compute_queue);
+
+        /* create swap images views, there are none when headless */
+        if (d->swapchain) {
+            uint32_t cnt = 0;
+            vkGetSwapchainImagesKHR(d->device, d->swapchain, &cnt, nullptr);
+
+            std::vector<VkImage> swap_imgs(cnt);
+            vkGetSwapchainImagesKHR(d->device, d->swapchain, &cnt,
+                    swap_imgs.data());
+
+            d->swap_img_views.resize(swap_imgs.size());
+
+            for (size_t i = 0; i < swap_imgs.size(); i++) {
+                VkImageViewCreateInfo view_info{
+                    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                    .image = swap_imgs[i],
+                    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+                    .format = phydev.surf_fmt.format,
+                    .components = {
+                        .r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                        .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                        .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                        .a = VK_COMPONENT_SWIZZLE_IDENTITY,
+                    },
+                    .subresourceRange = {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .baseMipLevel = 0,
+                        .levelCount = 1,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                    },
+                };
+                if (vkCreateImageView(d->device, &view_info, nullptr,
+                        &d->swap_img_views[i]) != VK_SUCCESS)
+                {
+                    EXCEPTION("failed to create image views!");
+                }
             }
         }
     }
 
+    /* Starts the recording of a new frame. Waits for the frame that used the
+    same fence, PGE_FRAMES_IN_FLIGHT frames ago, the pipelines retired before
+    it are destroyed. The returned fence must be signaled by the last submit
+    of the frame. */
+    VkFence begin_frame() {
+        uint64_t frame = d->frame;
+        VkFence fence = d->frame_fences[frame % d->frame_fences.size()];
+        if (vkWaitForFences(d->device, 1, &fence, VK_TRUE,
+                UINT64_MAX) != VK_SUCCESS)
+            EXCEPTION("failed to wait for the frame fence!");
+        if (frame >= d->frame_fences.size())
+            d->retire_queue.frame_completed(frame - d->frame_fences.size());
+        vkResetFences(d->device, 1, &fence);
+        d->retire_queue.begin_frame(frame);
+        d->frame++;
+        return fence;
+    }
+
+    /* all the frames are done after it, so are the retired pipelines */
     void wait_idle() {
-        if (d && d->device)
+        if (d && d->device) {
             vkDeviceWaitIdle(d->device);
+            d->retire_queue.clear();
+        }
     }
 
 private:
@@ -295,13 +415,43 @@ private:
         return ret_dev;
     }
 
+    uint32_t select_compute_index(VkPhysicalDevice phy_dev,
+            uint32_t graphic_index, bool async_compute)
+    {
+        if (!async_compute)
+            return graphic_index;
+        uint32_t cnt = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(phy_dev, &cnt, nullptr);
+        std::vector<VkQueueFamilyProperties> queue_families(cnt);
+        vkGetPhysicalDeviceQueueFamilyProperties(
+                phy_dev, &cnt, queue_families.data());
+        for (uint32_t i = 0; i < cnt; i++) {
+            auto flags = queue_families[i].queueFlags;
+            if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+                return i;
+        }
+        DBG("No compute only queue, compute stays on the graphic queue");
+        return graphic_index;
+    }
+
     dev_t get_phy_dev(VkPhysicalDevice phy_dev) {
         dev_t ret_dev;
         ret_dev.phy_dev = phy_dev;
         ret_dev.score = 1000;
 
-        // filter out devices without swapchains
+        /* offscreen, presents nothing and renders to it's own images */
         uint32_t cnt = 0;
+        if (!d->surface) {
+            ret_dev.capab = {};
+            ret_dev.surf_fmt = { VK_FORMAT_R8G8B8A8_UNORM,
+                    VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+            ret_dev.surf_pres = VK_PRESENT_MODE_FIFO_KHR;
+            ret_dev.extent = {};
+            ret_dev.swch_img_cnt = 0;
+            return get_phy_dev_queues(ret_dev);
+        }
+
+        // filter out devices without swapchains
         std::vector<const char*> req_exts = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
         vkEnumerateDeviceExtensionProperties(phy_dev, nullptr, &cnt, nullptr);
         std::vector<VkExtensionProperties> exts(cnt);
@@ -373,8 +523,13 @@ private:
             img_cnt = capab.maxImageCount;
 
         ret_dev.swch_img_cnt = img_cnt;
+        return get_phy_dev_queues(ret_dev);
+    }
 
-        cnt = 0;
+    /* the queues and the score of a device, the surface part is done */
+    dev_t get_phy_dev_queues(dev_t ret_dev) {
+        auto phy_dev = ret_dev.phy_dev;
+        uint32_t cnt = 0;
         vkGetPhysicalDeviceQueueFamilyProperties(phy_dev, &cnt, nullptr);
         std::vector<VkQueueFamilyProperties> queue_families(cnt);
         vkGetPhysicalDeviceQueueFamilyProperties(
@@ -385,19 +540,22 @@ private:
                 ret_dev.graphic_index = (uint32_t)i;
 
             VkBool32 pres_support = VK_FALSE;
-            vkGetPhysicalDeviceSurfaceSupportKHR(phy_dev, i, d->surface,
-                    &pres_support);
+            if (d->surface)
+                vkGetPhysicalDeviceSurfaceSupportKHR(phy_dev, i, d->surface,
+                        &pres_support);
             if (pres_support == VK_TRUE)
                 ret_dev.presentation_index = (uint32_t)i;
             i++;
         }
+        if (!d->surface)
+            ret_dev.presentation_index = ret_dev.graphic_index;
 
         if (ret_dev.graphic_index < 0 || ret_dev.presentation_index < 0) {
             DBG("No suitable device queue found");
             return { .score = -1 };
         }
 
-        VkPhysicalDeviceProperties dev_props;
+        VkPhysicalDeviceProperties &dev_props = ret_dev.props;
         VkPhysicalDeviceFeatures dev_features;
         vkGetPhysicalDeviceProperties(phy_dev, &dev_props);
         vkGetPhysicalDeviceFeatures(phy_dev, &dev_features);
@@ -472,9 +630,11 @@ private:
         return VK_FALSE;
     }
 
-    std::vector<const char*> get_required_inst_extensions() {
+    std::vector<const char*> get_required_inst_extensions(bool headless) {
         uint32_t cnt = 0;
-        const char**glfw_exts = glfwGetRequiredInstanceExtensions(&cnt);
+        const char**glfw_exts = nullptr;
+        if (!headless)
+            glfw_exts = glfwGetRequiredInstanceExtensions(&cnt);
 
         std::vector<const char*> req_exts(glfw_exts, glfw_exts + cnt);
         req_exts.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -500,6 +660,9 @@ private:
     }
 };
 
+/* the window the pipelines are created for */
+using PgeWindow = Window;
+
 } // namespace pge
 
 #endif
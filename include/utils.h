@@ -9,8 +9,19 @@
 #include <memory>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <queue>
+#include <functional>
 #include <filesystem>
 #include <fstream>
+#include <cstring>
+#include <cinttypes>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "json.h"
 
 namespace pge
@@ -19,6 +30,130 @@ namespace pge
 /* FS UTILS (I know that I will need them):
 ============================================================================= */
 
+/* Read-only memory mapping of a whole file, unmapped at destruction. data is
+nullptr if the file couldn't be mapped (missing, empty, etc.) */
+struct MappedFile {
+	void *data = nullptr;
+	size_t size = 0;
+
+	MappedFile() {}
+	MappedFile(const std::string& path) { map(path); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+	~MappedFile() { unmap(); }
+
+	bool map(const std::string& path) {
+		unmap();
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ptr != MAP_FAILED) {
+				data = ptr;
+				size = st.st_size;
+			}
+		}
+		close(fd);
+		return data != nullptr;
+	}
+
+	void unmap() {
+		if (data)
+			munmap(data, size);
+		data = nullptr;
+		size = 0;
+	}
+};
+
+/* writes to a temporary file and renames it over path, so that readers never
+see a partially written file */
+inline bool write_file_atomic(const std::string& path, const void *data,
+		size_t size)
+{
+	std::string tmp_path = path + ".tmp" + std::to_string(getpid()) + "_" +
+			std::to_string(std::hash<std::thread::id>{}(
+					std::this_thread::get_id()));
+	std::ofstream out(tmp_path, std::ios::binary);
+	if (!out.good())
+		return false;
+	out.write((const char *)data, size);
+	out.close();
+	if (!out.good() || rename(tmp_path.c_str(), path.c_str()) != 0) {
+		remove(tmp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+/* HASH UTILS:
+============================================================================= */
+
+constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+inline uint64_t fnv1a_64(const void *data, size_t size,
+		uint64_t hash = FNV_OFFSET)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+inline uint64_t fnv1a_64(const std::string& str, uint64_t hash = FNV_OFFSET) {
+	return fnv1a_64(str.data(), str.size(), hash);
+}
+
+/* Accumulates fnv1a over a sequence of values. Only types without padding
+should be added as a whole, structs with padding must be added field by field
+because their padding bytes are not defined. */
+struct Hasher {
+	uint64_t hash = FNV_OFFSET;
+
+	Hasher& add(const void *data, size_t size) {
+		hash = fnv1a_64(data, size, hash);
+		return *this;
+	}
+
+	template <typename T>
+	Hasher& add(const T& value) {
+		static_assert(std::has_unique_object_representations_v<T> ||
+				std::is_floating_point_v<T>,
+				"add the fields of structs with padding one by one");
+		return add(&value, sizeof(value));
+	}
+
+	Hasher& add(bool value) {
+		uint8_t byte = value;
+		return add(&byte, 1);
+	}
+
+	Hasher& add(const std::string& str) {
+		size_t size = str.size();
+		add(&size, sizeof(size));
+		return add(str.data(), str.size());
+	}
+
+	template <typename T>
+	Hasher& add(const std::vector<T>& vec) {
+		size_t size = vec.size();
+		add(&size, sizeof(size));
+		for (auto &&value : vec)
+			add(value);
+		return *this;
+	}
+};
+
+inline std::string hash_to_str(uint64_t hash) {
+	char buff[17] = {0};
+	snprintf(buff, sizeof(buff), "%016" PRIx64, hash);
+	return buff;
+}
+
 /* TIME UTILS:
 ============================================================================= */
 
@@ -44,6 +179,89 @@ struct TimePointMs {
 	}
 };
 
+inline uint64_t get_time_us() {
+	using namespace std::chrono;
+	return duration_cast<microseconds>(
+		steady_clock::now().time_since_epoch()
+	).count();
+}
+
+struct TimePointUs {
+	uint64_t start;
+	TimePointUs() {
+		start = get_time_us();
+	}
+
+	uint64_t elapsed() {
+		return get_time_us() - start;
+	}
+};
+
+/* THREAD UTILS:
+============================================================================= */
+
+/* Fixed size pool of workers that run submitted tasks in order. Tasks still in
+the queue at destruction are executed before the workers are joined. */
+struct ThreadPool {
+	ThreadPool(size_t thread_cnt = std::thread::hardware_concurrency()) {
+		if (!thread_cnt)
+			thread_cnt = 1;
+		for (size_t i = 0; i < thread_cnt; i++)
+			workers.emplace_back([this]{ worker_loop(); });
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator = (const ThreadPool&) = delete;
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			stop = true;
+		}
+		cv.notify_all();
+		for (auto &&worker : workers)
+			worker.join();
+	}
+
+	template <typename Fn>
+	auto submit(Fn&& fn) -> std::future<decltype(fn())> {
+		using ret_t = decltype(fn());
+		auto task = std::make_shared<std::packaged_task<ret_t()>>(
+				std::forward<Fn>(fn));
+		auto ret = task->get_future();
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			tasks.push([task]{ (*task)(); });
+		}
+		cv.notify_one();
+		return ret;
+	}
+
+	size_t size() const { return workers.size(); }
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mu;
+	std::condition_variable cv;
+	bool stop = false;
+
+	void worker_loop() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mu);
+				cv.wait(lock, [this]{ return stop || !tasks.empty(); });
+				if (stop && tasks.empty())
+					return ;
+				task = std::move(tasks.front());
+				tasks.pop();
+			}
+			task();
+		}
+	}
+};
+
 /* DEMANGLE:
 ============================================================================= */
 
@@ -4,57 +4,123 @@
 #include "shader_compile.h"
 
 #include <shaderc/shaderc.hpp>
+#include <spirv-tools/optimizer.hpp>
 #include <string>
 #include <fstream>
 #include <streambuf>
+#include <filesystem>
 
-[[maybe_unused]]
-static std::string preprocess_shader(const std::string& source_name,
-		shaderc_shader_kind kind, const std::string& source)
-{
-	shaderc::Compiler compiler;
-	shaderc::CompileOptions options;
+using shc_macros_t = std::vector<std::pair<std::string, std::string>>;
 
-	// Like -DMY_DEFINE=1
-	options.AddMacroDefinition("MY_DEFINE", "1");
+/* Macros passed to every compilation, they are also part of the cache key.
+Per shader macros come from the defines of each compilation. */
+static const shc_macros_t default_macros = {
+	// Like -DMY_DEFINE=1: {"MY_DEFINE", "1"},
+};
 
-	shaderc::PreprocessedSourceCompilationResult result =
-			compiler.PreprocessGlsl(source, kind, source_name.c_str(), options);
+/* Set by shc_set_cache_dir and shc_add_include_dir. Replaced as a whole under
+config_mu and never modified after, a compilation keeps the one it started
+with, so a change made while a batch runs doesn't reach the running jobs */
+struct shc_config_t {
+	/* Directory of the on-disk SPIR-V cache, empty if the cache is disabled */
+	std::string cache_dir;
 
-	if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
-		DBG("%s", result.GetErrorMessage());
-		return "";
-	}
+	/* Searched by #include <file> and by #include "file" if the file isn't
+	found next to the including shader */
+	std::vector<std::string> include_dirs;
+};
 
-	return {result.cbegin(), result.cend()};
+static std::mutex config_mu;
+static std::shared_ptr<const shc_config_t> config =
+		std::make_shared<shc_config_t>();
+
+static std::shared_ptr<const shc_config_t> get_config() {
+	std::lock_guard<std::mutex> guard(config_mu);
+	return config;
 }
 
+/* A file pulled in by #include, with the hash of it's content at compile
+time */
+struct shc_dep_t {
+	std::string path;
+	uint64_t hash;
+};
 
-// Compiles a shader to SPIR-V assembly. Returns the assembly text
-// as a string.
-[[maybe_unused]]
-static std::string compile_file_to_assembly(const std::string& source_name,
-		shaderc_shader_kind kind, const std::string& source,
-		bool optimize = false)
-{
-	shaderc::Compiler compiler;
-	shaderc::CompileOptions options;
+static bool hash_file(const std::string& path, uint64_t& hash) {
+	pge::MappedFile file(path);
+	if (!file.data && !std::filesystem::exists(path))
+		return false;
+	hash = pge::fnv1a_64(file.data, file.size);
+	return true;
+}
 
-	// Like -DMY_DEFINE=1
-	options.AddMacroDefinition("MY_DEFINE", "1");
-	if (optimize)
-		options.SetOptimizationLevel(shaderc_optimization_level_size);
+/* Resolves includes and records every included file inside deps */
+struct shc_includer_t : public shaderc::CompileOptions::IncluderInterface {
+	struct include_t {
+		shaderc_include_result result;
+		std::string path;
+		std::string content;
+	};
 
-	shaderc::AssemblyCompilationResult result = compiler.CompileGlslToSpvAssembly(
-		source, kind, source_name.c_str(), options);
+	std::vector<shc_dep_t> *deps;
+	const std::shared_ptr<const shc_config_t> *config;
 
-	if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
-		DBG("%s", result.GetErrorMessage());
-		return "";
+	shc_includer_t(std::vector<shc_dep_t> *deps,
+			const std::shared_ptr<const shc_config_t> *config)
+	: deps(deps), config(config) {}
+
+	shaderc_include_result *GetInclude(const char *requested,
+			shaderc_include_type type, const char *requesting,
+			size_t include_depth) override
+	{
+		auto inc = new include_t;
+		inc->path = resolve(requested, type, requesting);
+
+		std::ifstream t(inc->path);
+		if (inc->path.empty() || !t.good()) {
+			/* shaderc takes an empty name as an error, content is the msg */
+			inc->path = "";
+			inc->content = pge::sformat("Can't find include file: %s",
+					requested);
+		}
+		else {
+			inc->content.assign((std::istreambuf_iterator<char>(t)),
+					std::istreambuf_iterator<char>());
+			deps->push_back(shc_dep_t{ .path = inc->path,
+					.hash = pge::fnv1a_64(inc->content) });
+		}
+
+		inc->result = shaderc_include_result{
+			.source_name = inc->path.c_str(),
+			.source_name_length = inc->path.size(),
+			.content = inc->content.c_str(),
+			.content_length = inc->content.size(),
+			.user_data = inc,
+		};
+		return &inc->result;
 	}
 
-	return {result.cbegin(), result.cend()};
-}
+	void ReleaseInclude(shaderc_include_result *data) override {
+		delete (include_t *)data->user_data;
+	}
+
+	std::string resolve(const std::string& requested, shaderc_include_type type,
+			const std::string& requesting)
+	{
+		namespace fs = std::filesystem;
+		if (type == shaderc_include_type_relative) {
+			fs::path path = fs::path(requesting).parent_path() / requested;
+			if (fs::exists(path))
+				return path.lexically_normal().string();
+		}
+		for (auto &&dir : (*config)->include_dirs) {
+			fs::path path = fs::path(dir) / requested;
+			if (fs::exists(path))
+				return path.lexically_normal().string();
+		}
+		return "";
+	}
+};
 
 static shaderc_shader_kind get_shader_kind(int shader_type) {
 	switch (shader_type) {
@@ -74,68 +140,572 @@ static shaderc_shader_kind get_shader_kind(int shader_type) {
 	}
 }
 
-// Compiles a shader to a SPIR-V binary. Returns the binary as
-// a vector of 32-bit words.
-static std::vector<uint32_t> compile_shader_src(const std::string& name,
-		const std::string& source, int kind,
-		bool optimize)
-{
-	shaderc::Compiler compiler;
+static shaderc_optimization_level get_opt_level(int opt_level) {
+	switch (opt_level) {
+		case SHC_OPT_SIZE:
+			return shaderc_optimization_level_size;
+		case SHC_OPT_PERFORMANCE:
+			return shaderc_optimization_level_performance;
+		default: return shaderc_optimization_level_zero;
+	}
+}
+
+static bool valid_opt_level(int opt_level) {
+	return opt_level >= SHC_OPT_ZERO && opt_level <= SHC_OPT_PERFORMANCE;
+}
+
+static shaderc::CompileOptions make_options(int opt_level) {
 	shaderc::CompileOptions options;
 
-	// Like -DMY_DEFINE=1
-	options.AddMacroDefinition("MY_DEFINE", "1");
-	if (optimize) options.SetOptimizationLevel(shaderc_optimization_level_size);
+	for (auto &&[macro, value] : default_macros)
+		options.AddMacroDefinition(macro, value);
+	options.SetOptimizationLevel(get_opt_level(opt_level));
+	return options;
+}
+
+/* Long lived compiler state. Constructing a shaderc::Compiler initializes
+glslang, so it is done once per context instead of once per shader. */
+struct shc_ctx_t {
+	std::vector<shc_dep_t> deps;    // includes of the last compilation
+	std::shared_ptr<const shc_config_t> config; // of the last compilation
+	shaderc::Compiler compiler;
+	shaderc::CompileOptions options[SHC_OPT_PERFORMANCE + 1];
+
+	shc_ctx_t() : config(get_config()), options{ make_options(SHC_OPT_ZERO),
+			make_options(SHC_OPT_SIZE), make_options(SHC_OPT_PERFORMANCE) }
+	{
+		for (auto &opt : options)
+			opt.SetIncluder(std::make_unique<shc_includer_t>(&deps, &config));
+	}
+
+	/* opt_level must be valid, one of SHC_OPT_* */
+	const shaderc::CompileOptions& get_options(int opt_level) const {
+		return options[opt_level];
+	}
+};
+
+/* Used by the functions that don't receive a context */
+static shc_ctx_t *get_thread_ctx() {
+	thread_local std::unique_ptr<shc_ctx_t> ctx = std::make_unique<shc_ctx_t>();
+	return ctx.get();
+}
+
+[[maybe_unused]]
+static std::string preprocess_shader(shc_ctx_t *ctx,
+		const std::string& source_name, shaderc_shader_kind kind,
+		const std::string& source)
+{
+	ctx->config = get_config();
+	shaderc::PreprocessedSourceCompilationResult result =
+			ctx->compiler.PreprocessGlsl(source, kind, source_name.c_str(),
+			ctx->get_options(SHC_OPT_ZERO));
+
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+		DBG("%s", result.GetErrorMessage());
+		return "";
+	}
+
+	return {result.cbegin(), result.cend()};
+}
+
+
+// Compiles a shader to SPIR-V assembly. Returns the assembly text
+// as a string.
+[[maybe_unused]]
+static std::string compile_file_to_assembly(shc_ctx_t *ctx,
+		const std::string& source_name, shaderc_shader_kind kind,
+		const std::string& source, int opt_level = SHC_OPT_ZERO)
+{
+	shaderc::AssemblyCompilationResult result =
+			ctx->compiler.CompileGlslToSpvAssembly(source, kind,
+			source_name.c_str(), ctx->get_options(opt_level));
+
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+		DBG("%s", result.GetErrorMessage());
+		return "";
+	}
+
+	return {result.cbegin(), result.cend()};
+}
+
+// The cache key covers everything that can change the resulting binary. The
+// quoted includes are looked up next to the shader first, so the directory of
+// name is part of it: the same source in two directories can include
+// different files.
+static uint64_t get_cache_key(const shc_config_t& cfg, const std::string& name,
+		const std::string& source, int kind, int opt_level, uint32_t passes,
+		const shc_macros_t& macros)
+{
+	int lib_version = LIB_VERSION;
+	uint64_t key = pge::fnv1a_64(&lib_version, sizeof(lib_version));
+	key = pge::fnv1a_64(&kind, sizeof(kind), key);
+	key = pge::fnv1a_64(&opt_level, sizeof(opt_level), key);
+	key = pge::fnv1a_64(&passes, sizeof(passes), key);
+	for (auto &&[macro, value] : default_macros)
+		key = pge::fnv1a_64(macro + "=" + value + ";", key);
+	for (auto &&[macro, value] : macros)
+		key = pge::fnv1a_64(macro + "=" + value + ";", key);
+	for (auto &&dir : cfg.include_dirs)
+		key = pge::fnv1a_64(dir + ";", key);
+	std::error_code ec;
+	auto src_dir = std::filesystem::absolute(
+			std::filesystem::path(name).parent_path(), ec);
+	key = pge::fnv1a_64(src_dir.lexically_normal().string() + ";", key);
+	return pge::fnv1a_64(source, key);
+}
+
+static std::string get_cache_path(const shc_config_t& cfg, uint64_t key) {
+	return cfg.cache_dir + pge::hash_to_str(key) + ".spv";
+}
+
+/* The dependency index of an entry, one line per included file:
+"<hash> <path>". Entries of shaders without includes don't have one. */
+static std::string get_deps_path(const shc_config_t& cfg, uint64_t key) {
+	return cfg.cache_dir + pge::hash_to_str(key) + ".dep";
+}
+
+/* true if none of the files included by the entry changed since it was
+compiled */
+static bool cache_deps_valid(const shc_config_t& cfg, uint64_t key) {
+	std::ifstream in(get_deps_path(cfg, key));
+	if (!in.good())
+		return true;
+	std::string hash_str;
+	std::string path;
+	while (in >> hash_str && std::getline(in >> std::ws, path)) {
+		uint64_t hash = 0;
+		if (!hash_file(path, hash) || pge::hash_to_str(hash) != hash_str)
+			return false;
+	}
+	return true;
+}
+
+/* on a hit, file holds the mapping that words points into */
+static bool cache_load(const shc_config_t& cfg, uint64_t key,
+		pge::MappedFile& file, const uint32_t *&words, size_t& word_cnt)
+{
+	if (cfg.cache_dir.empty())
+		return false;
+	if (!file.map(get_cache_path(cfg, key)) ||
+			file.size % sizeof(uint32_t) != 0)
+		return false;
+	if (!cache_deps_valid(cfg, key)) {
+		file.unmap();
+		return false;
+	}
+	words = (const uint32_t *)file.data;
+	word_cnt = file.size / sizeof(uint32_t);
+	return true;
+}
+
+static void cache_store(const shc_config_t& cfg, uint64_t key,
+		const uint32_t *words, size_t word_cnt,
+		const std::vector<shc_dep_t>& deps)
+{
+	if (cfg.cache_dir.empty() || !word_cnt)
+		return ;
+
+	/* the index is written first, so an entry is never seen without it */
+	std::string index;
+	for (auto &&dep : deps)
+		index += pge::hash_to_str(dep.hash) + " " + dep.path + "\n";
+	if (index.size() && !pge::write_file_atomic(get_deps_path(cfg, key),
+			index.data(), index.size()))
+	{
+		DBG("Failed to write shader cache deps: %s",
+				get_deps_path(cfg, key).c_str());
+		return ;
+	}
+	if (index.empty())
+		remove(get_deps_path(cfg, key).c_str());
+
+	if (!pge::write_file_atomic(get_cache_path(cfg, key), words,
+			word_cnt * sizeof(uint32_t)))
+		DBG("Failed to write shader cache entry: %s",
+				get_cache_path(cfg, key).c_str());
+}
+
+/* Errors and warnings go to diag if the caller wants them, else they are
+printed */
+static void report_diag(std::string *diag, const std::string& msg) {
+	if (diag)
+		*diag += msg;
+	else
+		DBG("%s", msg);
+}
+
+/* Where the compiled SPIR-V ends up. alloc_fn is called once, with the final
+size, so the words are written a single time into their final home. */
+struct spv_out_t {
+	shc_alloc_fn_t alloc_fn;
+	void *usr;
+	size_t len = 0;
+
+	int write(const uint32_t *words, size_t word_cnt) {
+		uint32_t *dst = alloc_fn(usr, word_cnt);
+		if (!dst)
+			return SHC_ERR_ALLOC;
+		memcpy(dst, words, word_cnt * sizeof(uint32_t));
+		len = word_cnt;
+		return SHC_OK;
+	}
+};
+
+/* usr is the uint32_t * that receives the new buffer */
+static uint32_t *new_alloc(void *usr, size_t word_cnt) {
+	return *(uint32_t **)usr = new uint32_t[word_cnt];
+}
+
+static shc_macros_t get_macros(const shc_define_t *defines, size_t define_cnt) {
+	shc_macros_t macros;
+	for (size_t i = 0; i < define_cnt; i++)
+		macros.push_back({defines[i].name,
+				defines[i].value ? defines[i].value : ""});
+	return macros;
+}
+
+/* Runs the SHC_PASS_* passes of spirv-tools over the output of shaderc */
+static int run_passes(const uint32_t *words, size_t word_cnt, uint32_t passes,
+		std::vector<uint32_t>& result, std::string *diag)
+{
+	spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_0);
+	optimizer.SetMessageConsumer([diag](spv_message_level_t level,
+			const char *, const spv_position_t&, const char *msg)
+	{
+		if (level <= SPV_MSG_ERROR)
+			report_diag(diag, std::string(msg) + "\n");
+	});
+
+	/* the constants must be known before the dead code can be found */
+	if (passes & SHC_PASS_FOLD_SPEC) {
+		optimizer.RegisterPass(spvtools::CreateFreezeSpecConstantValuePass());
+		optimizer.RegisterPass(
+				spvtools::CreateFoldSpecConstantOpAndCompositePass());
+		optimizer.RegisterPass(spvtools::CreateUnifyConstantPass());
+		optimizer.RegisterPass(spvtools::CreateCCPPass());
+	}
+	if (passes & SHC_PASS_DCE) {
+		optimizer.RegisterPass(spvtools::CreateDeadBranchElimPass());
+		optimizer.RegisterPass(spvtools::CreateEliminateDeadFunctionsPass());
+		optimizer.RegisterPass(spvtools::CreateAggressiveDCEPass());
+		optimizer.RegisterPass(spvtools::CreateDeadVariableEliminationPass());
+		optimizer.RegisterPass(spvtools::CreateEliminateDeadConstantPass());
+	}
+
+	if (!optimizer.Run(words, word_cnt, &result)) {
+		report_diag(diag, "spirv-tools optimizer failed\n");
+		return SHC_ERR_COMPILE;
+	}
+	return SHC_OK;
+}
+
+// Compiles a shader to a SPIR-V binary and writes it to out. If the cache is
+// enabled and holds the binary, shaderc isn't used at all. macros are added
+// on top of the default ones. Returns SHC_OK or one of SHC_ERR_*.
+static int compile_src_to(shc_ctx_t *ctx, const std::string& name,
+		const std::string& source, int kind, int opt_level, uint32_t passes,
+		const shc_macros_t& macros, std::string *diag, spv_out_t& out)
+{
+	if (!valid_opt_level(opt_level)) {
+		report_diag(diag, "Invalid optimization level: " +
+				std::to_string(opt_level));
+		return SHC_ERR_ARGS;
+	}
+	ctx->config = get_config();
+	const shc_config_t& cfg = *ctx->config;
+	uint64_t key = get_cache_key(cfg, name, source, kind, opt_level, passes,
+			macros);
+	pge::MappedFile cached;
+	const uint32_t *words = nullptr;
+	size_t word_cnt = 0;
+	if (cache_load(cfg, key, cached, words, word_cnt))
+		return out.write(words, word_cnt);
+
+	/* the prebuilt options are only copied if we need to add to them */
+	std::unique_ptr<shaderc::CompileOptions> macro_options;
+	if (!macros.empty()) {
+		macro_options = std::make_unique<shaderc::CompileOptions>(
+				ctx->get_options(opt_level));
+		macro_options->SetIncluder(
+				std::make_unique<shc_includer_t>(&ctx->deps, &ctx->config));
+		for (auto &&[macro, value] : macros)
+			macro_options->AddMacroDefinition(macro, value);
+	}
+	ctx->deps.clear();
 
 	shaderc::SpvCompilationResult module =
-		compiler.CompileGlslToSpv(source, get_shader_kind(kind),
-		name.c_str(), options);
+		ctx->compiler.CompileGlslToSpv(source, get_shader_kind(kind),
+		name.c_str(), macro_options ? *macro_options :
+		ctx->get_options(opt_level));
 
 	if (module.GetCompilationStatus() != shaderc_compilation_status_success) {
-		DBG("%s", module.GetErrorMessage());
-		return std::vector<uint32_t>{};
+		report_diag(diag, module.GetErrorMessage());
+		return SHC_ERR_COMPILE;
 	}
+	if (diag && module.GetNumWarnings())
+		*diag += module.GetErrorMessage();
 
-	return {module.cbegin(), module.cend()};
+	words = module.cbegin();
+	word_cnt = module.cend() - module.cbegin();
+	std::vector<uint32_t> optimized;
+	if (passes) {
+		int ret = run_passes(words, word_cnt, passes, optimized, diag);
+		if (ret != SHC_OK)
+			return ret;
+		words = optimized.data();
+		word_cnt = optimized.size();
+	}
+	cache_store(cfg, key, words, word_cnt, ctx->deps);
+	return out.write(words, word_cnt);
 }
 
-static std::vector<uint32_t> compile_shader_path(const std::string& path,
-		int kind, bool optimize)
+static int compile_path_to(shc_ctx_t *ctx, const std::string& path, int kind,
+		int opt_level, uint32_t passes, const shc_macros_t& macros,
+		std::string *diag, spv_out_t& out)
 {
 	std::ifstream t(path);
+	if (!t.good()) {
+		report_diag(diag, "Can't open shader file: " + path);
+		return SHC_ERR_IO;
+	}
 	std::string src((std::istreambuf_iterator<char>(t)),
 			std::istreambuf_iterator<char>());
-	return compile_shader_src(path, src, kind, optimize);
+	return compile_src_to(ctx, path, src, kind, opt_level, passes, macros, diag,
+			out);
 }
 
-EXTERN_FN uint32_t *shc_compile_path(const char *path, int kind,
-		size_t *result_len, bool optimize)
+// Compiles a shader to a SPIR-V binary. Returns the binary as
+// a vector of 32-bit words, empty on failure.
+[[maybe_unused]]
+static std::vector<uint32_t> compile_shader_src(const std::string& name,
+		const std::string& source, int kind, int opt_level,
+		uint32_t passes = 0, const shc_macros_t& macros = {})
 {
-	if (!result_len || !path) {
-		DBG("name, src, result_len can't be NULL");
-		return NULL;
+	std::vector<uint32_t> ret;
+	spv_out_t out{ .alloc_fn = shc_vector_alloc, .usr = &ret };
+	if (compile_src_to(get_thread_ctx(), name, source, kind, opt_level, passes,
+			macros, nullptr, out) != SHC_OK)
+		return std::vector<uint32_t>{};
+	return ret;
+}
+
+[[maybe_unused]]
+static std::vector<uint32_t> compile_shader_path(const std::string& path,
+		int kind, int opt_level, uint32_t passes = 0,
+		const shc_macros_t& macros = {})
+{
+	std::vector<uint32_t> ret;
+	spv_out_t out{ .alloc_fn = shc_vector_alloc, .usr = &ret };
+	if (compile_path_to(get_thread_ctx(), path, kind, opt_level, passes, macros,
+			nullptr, out) != SHC_OK)
+		return std::vector<uint32_t>{};
+	return ret;
+}
+
+EXTERN_FN shc_ctx_t *shc_create_ctx() {
+	return new shc_ctx_t;
+}
+
+EXTERN_FN int shc_destroy_ctx(shc_ctx_t *ctx) {
+	delete ctx;
+	return 0;
+}
+
+EXTERN_FN int shc_ctx_compile_path_to(shc_ctx_t *ctx, const char *path,
+		const shc_opts_t *opts, shc_alloc_fn_t alloc_fn, void *usr,
+		size_t *result_len)
+{
+	if (!path || !opts || !alloc_fn || !result_len ||
+			(opts->define_cnt && !opts->defines))
+	{
+		DBG("path, opts, alloc_fn, result_len can't be NULL");
+		return SHC_ERR_ARGS;
 	}
-	auto vec = compile_shader_path(path, kind, optimize);
-	*result_len = vec.size();
-	uint32_t *ret = new uint32_t[vec.size()];
-	memcpy(ret, vec.data(), vec.size() * sizeof(uint32_t));
+	*result_len = 0;
+	spv_out_t out{ .alloc_fn = alloc_fn, .usr = usr };
+	int ret = compile_path_to(ctx ? ctx : get_thread_ctx(), path, opts->kind,
+			opts->opt_level, opts->passes,
+			get_macros(opts->defines, opts->define_cnt), nullptr, out);
+	*result_len = out.len;
 	return ret;
 }
 
-EXTERN_FN uint32_t *shc_compile_src(const char *name, const char *src,
+EXTERN_FN int shc_ctx_compile_src_to(shc_ctx_t *ctx, const char *name,
+		const char *src, const shc_opts_t *opts, shc_alloc_fn_t alloc_fn,
+		void *usr, size_t *result_len)
+{
+	if (!name || !src || !opts || !alloc_fn || !result_len ||
+			(opts->define_cnt && !opts->defines))
+	{
+		DBG("name, src, opts, alloc_fn, result_len can't be NULL");
+		return SHC_ERR_ARGS;
+	}
+	*result_len = 0;
+	spv_out_t out{ .alloc_fn = alloc_fn, .usr = usr };
+	int ret = compile_src_to(ctx ? ctx : get_thread_ctx(), name, src,
+			opts->kind, opts->opt_level, opts->passes,
+			get_macros(opts->defines, opts->define_cnt), nullptr, out);
+	*result_len = out.len;
+	return ret;
+}
+
+EXTERN_FN uint32_t *shc_ctx_compile_path(shc_ctx_t *ctx, const char *path,
 		int kind, size_t *result_len, bool optimize)
 {
-	if (!result_len || !name || !src) {
-		DBG("name, src, result_len can't be NULL");
+	if (!ctx || !result_len || !path) {
+		DBG("ctx, path, result_len can't be NULL");
+		return NULL;
+	}
+	uint32_t *ret = nullptr;
+	shc_opts_t opts{ .kind = kind,
+			.opt_level = optimize ? SHC_OPT_SIZE : SHC_OPT_ZERO };
+	if (shc_ctx_compile_path_to(ctx, path, &opts, new_alloc, &ret,
+			result_len) != SHC_OK)
+	{
+		delete [] ret;
+		return NULL;
+	}
+	return ret;
+}
+
+EXTERN_FN uint32_t *shc_ctx_compile_src(shc_ctx_t *ctx, const char *name,
+		const char *src, int kind, size_t *result_len, bool optimize)
+{
+	if (!ctx || !result_len || !name || !src) {
+		DBG("ctx, name, src, result_len can't be NULL");
+		return NULL;
+	}
+	uint32_t *ret = nullptr;
+	shc_opts_t opts{ .kind = kind,
+			.opt_level = optimize ? SHC_OPT_SIZE : SHC_OPT_ZERO };
+	if (shc_ctx_compile_src_to(ctx, name, src, &opts, new_alloc, &ret,
+			result_len) != SHC_OK)
+	{
+		delete [] ret;
 		return NULL;
 	}
-	auto vec = compile_shader_src(name, src, kind, optimize);
-	*result_len = vec.size();
-	uint32_t *ret = new uint32_t[vec.size()];
-	memcpy(ret, vec.data(), vec.size() * sizeof(uint32_t));
 	return ret;
 }
 
+EXTERN_FN uint32_t *shc_compile_path(const char *path, int kind,
+		size_t *result_len, bool optimize)
+{
+	return shc_ctx_compile_path(get_thread_ctx(), path, kind, result_len,
+			optimize);
+}
+
+EXTERN_FN uint32_t *shc_compile_src(const char *name, const char *src,
+		int kind, size_t *result_len, bool optimize)
+{
+	return shc_ctx_compile_src(get_thread_ctx(), name, src, kind, result_len,
+			optimize);
+}
+
+/* Workers are kept between batches, so the per-thread contexts are reused */
+static pge::ThreadPool& get_batch_pool() {
+	static pge::ThreadPool pool;
+	return pool;
+}
+
+static void compile_job(shc_job_t *job) {
+	shc_macros_t macros = get_macros(job->defines, job->define_cnt);
+
+	std::string diag;
+	job->result = nullptr;
+	spv_out_t out{ .alloc_fn = new_alloc, .usr = &job->result };
+	if (job->path)
+		job->status = compile_path_to(get_thread_ctx(), job->path, job->kind,
+				job->opt_level, job->passes, macros, &diag, out);
+	else
+		job->status = compile_src_to(get_thread_ctx(), job->name, job->src,
+				job->kind, job->opt_level, job->passes, macros, &diag, out);
+	job->result_len = out.len;
+	if (job->status != SHC_OK) {
+		delete [] job->result;
+		job->result = nullptr;
+		job->result_len = 0;
+	}
+
+	job->diag = nullptr;
+	if (diag.size()) {
+		job->diag = new char[diag.size() + 1];
+		memcpy(job->diag, diag.c_str(), diag.size() + 1);
+	}
+}
+
+EXTERN_FN int shc_compile_batch(shc_job_t *jobs, size_t job_cnt) {
+	if (!jobs && job_cnt) {
+		DBG("jobs can't be NULL");
+		return SHC_ERR_ARGS;
+	}
+	for (size_t i = 0; i < job_cnt; i++) {
+		if (!jobs[i].path && (!jobs[i].name || !jobs[i].src)) {
+			DBG("job %ld needs a path or a name and a src", i);
+			return SHC_ERR_ARGS;
+		}
+		if (jobs[i].define_cnt && !jobs[i].defines) {
+			DBG("job %ld has define_cnt but no defines", i);
+			return SHC_ERR_ARGS;
+		}
+	}
+
+	std::vector<std::future<void>> done;
+	for (size_t i = 0; i < job_cnt; i++)
+		done.push_back(get_batch_pool().submit([job = &jobs[i]] {
+			compile_job(job);
+		}));
+
+	int failed = 0;
+	for (size_t i = 0; i < job_cnt; i++) {
+		done[i].wait();
+		if (jobs[i].status != SHC_OK)
+			failed++;
+	}
+	return failed;
+}
+
+EXTERN_FN int shc_free_batch(shc_job_t *jobs, size_t job_cnt) {
+	for (size_t i = 0; i < job_cnt; i++) {
+		delete [] jobs[i].result;
+		delete [] jobs[i].diag;
+		jobs[i].result = nullptr;
+		jobs[i].result_len = 0;
+		jobs[i].diag = nullptr;
+	}
+	return 0;
+}
+
+EXTERN_FN int shc_add_include_dir(const char *dir) {
+	if (!dir) {
+		DBG("dir can't be NULL");
+		return SHC_ERR_ARGS;
+	}
+	std::lock_guard<std::mutex> guard(config_mu);
+	auto next = std::make_shared<shc_config_t>(*config);
+	next->include_dirs.push_back(dir);
+	config = std::move(next);
+	return SHC_OK;
+}
+
+EXTERN_FN int shc_set_cache_dir(const char *dir) {
+	std::string cache_dir = dir ? dir : "";
+	if (cache_dir.size()) {
+		std::error_code err;
+		std::filesystem::create_directories(cache_dir, err);
+		if (err) {
+			DBG("Can't create shader cache dir %s: %s", dir, err.message());
+			return -1;
+		}
+		if (cache_dir.back() != '/')
+			cache_dir += "/";
+	}
+	std::lock_guard<std::mutex> guard(config_mu);
+	auto next = std::make_shared<shc_config_t>(*config);
+	next->cache_dir = std::move(cache_dir);
+	config = std::move(next);
+	return 0;
+}
+
 EXTERN_FN int shc_free_shader(uint32_t *ptr) {
 	delete [] ptr;
 	return 0;
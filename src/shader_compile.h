@@ -2,9 +2,10 @@
 #define SHADER_COMPILE_H
 
 #include <dlfcn.h>
+#include <vector>
 #include "utils.h"
 
-#define LIB_VERSION 1
+#define LIB_VERSION 3
 
 enum {
 	SHC_VERTEX_SHADER,
@@ -15,18 +16,139 @@ enum {
 	SHC_TESS_EVALUATION_SHADER,
 };
 
+/* Return codes of the functions that return an int status */
+enum {
+	SHC_OK = 0,
+	SHC_ERR_ARGS = -1,      // invalid arguments, NULL pointers, etc.
+	SHC_ERR_IO = -2,        // couldn't read the shader file
+	SHC_ERR_COMPILE = -3,   // shaderc failed, see the diagnostics
+	SHC_ERR_ALLOC = -4,     // the allocator returned NULL
+};
+
+/* shaderc's optimization levels. SIZE is what the legacy bool optimize maps to,
+PERFORMANCE is the one meant for the shaders used at runtime. */
+enum {
+	SHC_OPT_ZERO,
+	SHC_OPT_SIZE,
+	SHC_OPT_PERFORMANCE,
+};
+
+/* Extra spirv-tools passes ran after shaderc, can be or-ed together */
+enum {
+	SHC_PASS_DCE = 1 << 0,          // dead functions, variables and constants
+	SHC_PASS_FOLD_SPEC = 1 << 1,    // freeze spec constants to their defaults
+	                                // and fold them, only if they won't be set
+};
+
+/* Like -Dname=value, value can be NULL for -Dname */
+struct shc_define_t {
+	const char *name;
+	const char *value;
+};
+
+struct shc_opts_t {
+	int kind;
+	int opt_level;          // one of SHC_OPT_*
+	uint32_t passes;        // SHC_PASS_* flags
+	const shc_define_t *defines;
+	size_t define_cnt;
+};
+
+/* Called once per compiled shader with the number of words of the result. It
+must return a buffer of at least word_cnt words (or NULL to fail with
+SHC_ERR_ALLOC), the SPIR-V is written directly inside it. */
+typedef uint32_t *(*shc_alloc_fn_t)(void *usr, size_t word_cnt);
+
+/* alloc_fn that compiles into a std::vector<uint32_t>, usr points to it */
+inline uint32_t *shc_vector_alloc(void *usr, size_t word_cnt) {
+	auto vec = (std::vector<uint32_t> *)usr;
+	vec->resize(word_cnt);
+	return vec->data();
+}
+
+/* Compiler context, keeps the shaderc compiler and options alive between
+compilations. A context must be used by only one thread at a time, so create
+one per thread. The functions without a context use a per-thread one. */
+struct shc_ctx_t;
+
+EXTERN_FN shc_ctx_t *shc_create_ctx();
+EXTERN_FN int shc_destroy_ctx(shc_ctx_t *ctx);
+
+/* Compile into memory given by alloc_fn, ctx can be NULL to use the calling
+thread's context. Return SHC_OK or one of SHC_ERR_*. */
+EXTERN_FN int shc_ctx_compile_path_to(shc_ctx_t *ctx, const char *path,
+		const shc_opts_t *opts, shc_alloc_fn_t alloc_fn, void *usr,
+		size_t *result_len);
+EXTERN_FN int shc_ctx_compile_src_to(shc_ctx_t *ctx, const char *name,
+		const char *src, const shc_opts_t *opts, shc_alloc_fn_t alloc_fn,
+		void *usr, size_t *result_len);
+
+/* Those return NULL on failure, free the result with shc_free_shader. optimize
+selects SHC_OPT_SIZE, without extra passes. */
+EXTERN_FN uint32_t *shc_ctx_compile_path(shc_ctx_t *ctx, const char *path,
+		int kind, size_t *result_len, bool optimize);
+EXTERN_FN uint32_t *shc_ctx_compile_src(shc_ctx_t *ctx, const char *name,
+		const char *src, int kind, size_t *result_len, bool optimize);
+
+/* A shader compiled by shc_compile_batch, either from path or from name + src.
+The outputs are owned by the lib and released with shc_free_batch. */
+struct shc_job_t {
+	const char *path;
+	const char *name;
+	const char *src;
+	int kind;
+	const shc_define_t *defines;
+	size_t define_cnt;
+	int opt_level;
+	uint32_t passes;
+
+	/* outputs: */
+	int status;             // SHC_OK or one of SHC_ERR_*
+	uint32_t *result;       // NULL if the compilation failed
+	size_t result_len;
+	char *diag;             // errors and warnings or NULL if there are none
+};
+
+/* Compiles all the jobs on the lib's worker pool (one worker per core, each
+with it's own compiler context). Returns the number of failed jobs or
+SHC_ERR_ARGS if the arguments are invalid. */
+EXTERN_FN int shc_compile_batch(shc_job_t *jobs, size_t job_cnt);
+EXTERN_FN int shc_free_batch(shc_job_t *jobs, size_t job_cnt);
+
 EXTERN_FN uint32_t *shc_compile_path(const char *path, int kind,
 		size_t *result_len, bool optimize);
 EXTERN_FN uint32_t *shc_compile_src(const char *name, const char *src, int kind,
 		size_t *result_len, bool optimize);
+
+/* Adds a directory searched by #include <file>, and by #include "file" when
+the file isn't next to the including shader. Not thread safe, add the dirs
+before compiling. */
+EXTERN_FN int shc_add_include_dir(const char *dir);
+
+/* Enables the on-disk SPIR-V cache inside dir (created if missing), shaders
+compiled with the same source, kind, macros, optimization level, passes and
+LIB_VERSION are loaded from there. Entries remember the hashes of the files they
+include and are recompiled when one of those changes. NULL or "" disables the
+cache. */
+EXTERN_FN int shc_set_cache_dir(const char *dir);
 EXTERN_FN int shc_free_shader(uint32_t *ptr);
 EXTERN_FN int shc_get_version();
 
 /* Struct meant for fast loading the .so into a lib */
 struct ShaderC {
 	void *handle = nullptr;
+	SO_DECLARE_FN(shc_create_ctx)
+	SO_DECLARE_FN(shc_destroy_ctx)
+	SO_DECLARE_FN(shc_ctx_compile_path_to)
+	SO_DECLARE_FN(shc_ctx_compile_src_to)
+	SO_DECLARE_FN(shc_ctx_compile_path)
+	SO_DECLARE_FN(shc_ctx_compile_src)
+	SO_DECLARE_FN(shc_compile_batch)
+	SO_DECLARE_FN(shc_free_batch)
 	SO_DECLARE_FN(shc_compile_path)
 	SO_DECLARE_FN(shc_compile_src)
+	SO_DECLARE_FN(shc_add_include_dir)
+	SO_DECLARE_FN(shc_set_cache_dir)
 	SO_DECLARE_FN(shc_free_shader)
 	SO_DECLARE_FN(shc_get_version)
 
@@ -38,8 +160,18 @@ struct ShaderC {
 		}
 		bool success = false;
 		do {
+			SO_LOAD_FN(handle, shc_create_ctx);
+			SO_LOAD_FN(handle, shc_destroy_ctx);
+			SO_LOAD_FN(handle, shc_ctx_compile_path_to);
+			SO_LOAD_FN(handle, shc_ctx_compile_src_to);
+			SO_LOAD_FN(handle, shc_ctx_compile_path);
+			SO_LOAD_FN(handle, shc_ctx_compile_src);
+			SO_LOAD_FN(handle, shc_compile_batch);
+			SO_LOAD_FN(handle, shc_free_batch);
 			SO_LOAD_FN(handle, shc_compile_path);
 			SO_LOAD_FN(handle, shc_compile_src);
+			SO_LOAD_FN(handle, shc_add_include_dir);
+			SO_LOAD_FN(handle, shc_set_cache_dir);
 			SO_LOAD_FN(handle, shc_free_shader);
 			SO_LOAD_FN(handle, shc_get_version);
 			success = true;
@@ -58,6 +190,23 @@ struct ShaderC {
 		return 0;
 	}
 
+	/* compiles straight into out, returns SHC_OK or one of SHC_ERR_* */
+	int compile_path(const char *path, const shc_opts_t& opts,
+			std::vector<uint32_t>& out, shc_ctx_t *ctx = nullptr)
+	{
+		size_t len = 0;
+		return shc_ctx_compile_path_to_fn(ctx, path, &opts, shc_vector_alloc,
+				&out, &len);
+	}
+
+	int compile_src(const char *name, const char *src, const shc_opts_t& opts,
+			std::vector<uint32_t>& out, shc_ctx_t *ctx = nullptr)
+	{
+		size_t len = 0;
+		return shc_ctx_compile_src_to_fn(ctx, name, src, &opts,
+				shc_vector_alloc, &out, &len);
+	}
+
 	void unload() {
 		if (handle) {
 			dlclose(handle);
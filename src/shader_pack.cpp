@@ -0,0 +1,207 @@
+// Offline tool that compiles the shaders of a manifest with libshc.so and
+// writes them into one shader pack (see pge_shader_pack.h). Manifest format:
+// { "shaders": [ { "path": "a.vert", "name": "a.vert", "kind": "vertex",
+//                  "opt_level": "performance", "passes": [ "dce" ],
+//                  "defines": { "KEY": "VALUE" } } ] }
+// Only path is required, paths are relative to the manifest, the name defaults
+// to the path, the kind to the one given by the extension and the opt_level
+// to performance. opt_level is one of zero, size, performance and passes can
+// hold dce and fold_spec (see SHC_PASS_*).
+
+#include "utils.h"
+#include "shader_compile.h"
+#include "pge_shader_pack.h"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+struct manifest_shader_t {
+	std::string name;
+	std::string path;
+	int kind;
+	int opt_level;
+	uint32_t passes;
+	std::vector<std::pair<std::string, std::string>> define_strs;
+	std::vector<shc_define_t> defines;
+};
+
+static int get_kind(const std::string& kind) {
+	static const std::pair<const char *, int> kinds[] = {
+		{"vertex", SHC_VERTEX_SHADER},
+		{"fragment", SHC_FRAGMENT_SHADER},
+		{"compute", SHC_COMPUTE_SHADER},
+		{"geometry", SHC_GEOMETRY_SHADER},
+		{"tess_control", SHC_TESS_CONTROL_SHADER},
+		{"tess_evaluation", SHC_TESS_EVALUATION_SHADER},
+		{".vert", SHC_VERTEX_SHADER},
+		{".frag", SHC_FRAGMENT_SHADER},
+		{".comp", SHC_COMPUTE_SHADER},
+		{".geom", SHC_GEOMETRY_SHADER},
+		{".tesc", SHC_TESS_CONTROL_SHADER},
+		{".tese", SHC_TESS_EVALUATION_SHADER},
+	};
+	for (auto &&[name, value] : kinds)
+		if (kind == name)
+			return value;
+	EXCEPTION("Unknown shader kind: %s", kind);
+}
+
+static int get_opt_level(const std::string& level) {
+	static const std::pair<const char *, int> levels[] = {
+		{"zero", SHC_OPT_ZERO},
+		{"size", SHC_OPT_SIZE},
+		{"performance", SHC_OPT_PERFORMANCE},
+	};
+	for (auto &&[name, value] : levels)
+		if (level == name)
+			return value;
+	EXCEPTION("Unknown optimization level: %s", level);
+}
+
+static uint32_t get_pass(const std::string& pass) {
+	static const std::pair<const char *, uint32_t> passes[] = {
+		{"dce", SHC_PASS_DCE},
+		{"fold_spec", SHC_PASS_FOLD_SPEC},
+	};
+	for (auto &&[name, value] : passes)
+		if (pass == name)
+			return value;
+	EXCEPTION("Unknown pass: %s", pass);
+}
+
+static std::vector<manifest_shader_t> load_manifest(const char *path) {
+	auto manifest = pge::load_config(path);
+	std::string base_path = JSON_SSTR(manifest, "base_path");
+
+	std::vector<manifest_shader_t> shaders;
+	for (auto &&cfg : JSON_GET(manifest, "shaders")) {
+		manifest_shader_t shader;
+		shader.path = base_path + JSON_SSTR(cfg, "path");
+		shader.name = cfg.contains("name") ? JSON_SSTR(cfg, "name") :
+				JSON_SSTR(cfg, "path");
+		shader.kind = cfg.contains("kind") ? get_kind(JSON_SSTR(cfg, "kind")) :
+				get_kind(std::filesystem::path(shader.path).extension());
+		shader.opt_level = cfg.contains("opt_level") ?
+				get_opt_level(JSON_SSTR(cfg, "opt_level")) :
+				SHC_OPT_PERFORMANCE;
+		shader.passes = 0;
+		if (cfg.contains("passes"))
+			for (auto &&pass : JSON_GET(cfg, "passes"))
+				shader.passes |= get_pass(pass.get<std::string>());
+		if (cfg.contains("defines"))
+			for (auto &&[key, value] : JSON_GET(cfg, "defines").items())
+				shader.define_strs.push_back({key, value.get<std::string>()});
+		shaders.push_back(shader);
+	}
+
+	/* the strings don't move anymore, so we can point to them */
+	for (auto &&shader : shaders)
+		for (auto &&[key, value] : shader.define_strs)
+			shader.defines.push_back({key.c_str(), value.c_str()});
+	return shaders;
+}
+
+static int write_pack(const char *path,
+		const std::vector<manifest_shader_t>& shaders,
+		const std::vector<shc_job_t>& jobs)
+{
+	std::vector<pge::shader_pack_entry_t> entries;
+	for (size_t i = 0; i < shaders.size(); i++)
+		entries.push_back(pge::shader_pack_entry_t{
+			.name_hash = pge::fnv1a_64(shaders[i].name),
+			.content_hash = pge::fnv1a_64(jobs[i].result,
+					jobs[i].result_len * sizeof(uint32_t)),
+			.offset = i,    // temporarily the job index
+			.size = jobs[i].result_len * sizeof(uint32_t),
+		});
+	std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) {
+		return a.name_hash < b.name_hash;
+	});
+	for (size_t i = 1; i < entries.size(); i++)
+		if (entries[i].name_hash == entries[i - 1].name_hash) {
+			DBG("Shader names %s and %s have the same hash",
+					shaders[entries[i].offset].name,
+					shaders[entries[i - 1].offset].name);
+			return -1;
+		}
+
+	pge::shader_pack_header_t header{
+		.magic = pge::SHADER_PACK_MAGIC,
+		.version = pge::SHADER_PACK_VERSION,
+		.entry_cnt = (uint32_t)entries.size(),
+	};
+	uint64_t offset = sizeof(header) + entries.size() * sizeof(entries[0]);
+	std::vector<const uint32_t *> blobs;
+	for (auto &&entry : entries) {
+		blobs.push_back(jobs[entry.offset].result);
+		offset = pge::shader_pack_align(offset);
+		entry.offset = offset;
+		offset += entry.size;
+	}
+
+	std::vector<uint8_t> pack(offset, 0);
+	memcpy(pack.data(), &header, sizeof(header));
+	memcpy(pack.data() + sizeof(header), entries.data(),
+			entries.size() * sizeof(entries[0]));
+	for (size_t i = 0; i < entries.size(); i++)
+		memcpy(pack.data() + entries[i].offset, blobs[i], entries[i].size);
+
+	if (!pge::write_file_atomic(path, pack.data(), pack.size())) {
+		DBG("Failed to write shader pack: %s", path);
+		return -1;
+	}
+	DBG("Wrote %ld shaders, %ld bytes into %s", entries.size(), pack.size(),
+			path);
+	return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+	if (argc != 3) {
+		DBG("usage: %s <manifest.json> <output.pack>", argv[0]);
+		return -1;
+	}
+
+	std::vector<manifest_shader_t> shaders;
+	try {
+		shaders = load_manifest(argv[1]);
+	}
+	catch (std::exception &e) {
+		DBG("Failed to load the manifest: %s", e.what());
+		return -1;
+	}
+
+	ShaderC shc;
+	if (shc.load("./libshc.so") != 0) {
+		DBG("Couldn't load shader compiler lib");
+		return -1;
+	}
+	shc.shc_set_cache_dir_fn("shader_cache/");
+
+	std::vector<shc_job_t> jobs;
+	for (auto &&shader : shaders)
+		jobs.push_back(shc_job_t{
+			.path = shader.path.c_str(),
+			.kind = shader.kind,
+			.defines = shader.defines.data(),
+			.define_cnt = shader.defines.size(),
+			.opt_level = shader.opt_level,
+			.passes = shader.passes,
+		});
+
+	int failed = shc.shc_compile_batch_fn(jobs.data(), jobs.size());
+	for (size_t i = 0; i < jobs.size(); i++)
+		if (jobs[i].diag)
+			DBG("%s: %s", shaders[i].path, jobs[i].diag);
+
+	int ret = -1;
+	if (failed == 0)
+		ret = write_pack(argv[2], shaders, jobs);
+	else
+		DBG("%d shaders failed to compile", failed);
+
+	shc.shc_free_batch_fn(jobs.data(), jobs.size());
+	shc.unload();
+	return ret;
+}
@@ -0,0 +1,322 @@
+#include "utils.h"
+#include "pge_pipeline_data.h"
+
+#include <vector>
+#include <thread>
+
+/* the order of the pipeline creator stages, checked at compile time */
+static_assert(pge::pipeline_can_enter(pge::STATE_INIT_START,
+		pge::STATE_VERTEX_INPUT, false));
+static_assert(pge::pipeline_can_enter(pge::STATE_VERTEX_SHADER,
+		pge::STATE_RASTERIZER, false));
+static_assert(pge::pipeline_can_enter(pge::STATE_TESSELLATION,
+		pge::STATE_RASTERIZER, false));
+static_assert(pge::pipeline_can_enter(pge::STATE_RENDER_PASS,
+		pge::STATE_INIT_DONE, false));
+
+/* no going back, no repeat and no skipping a stage that isn't optional */
+static_assert(!pge::pipeline_can_enter(pge::STATE_RASTERIZER,
+		pge::STATE_VERTEX_SHADER, false));
+static_assert(!pge::pipeline_can_enter(pge::STATE_VERTEX_SHADER,
+		pge::STATE_VERTEX_SHADER, false));
+static_assert(!pge::pipeline_can_enter(pge::STATE_INIT_START,
+		pge::STATE_RASTERIZER, false));
+static_assert(!pge::pipeline_can_enter(pge::STATE_LAYOUTS,
+		pge::STATE_INIT_DONE, false));
+
+/* a derived pipeline only keeps the order */
+static_assert(pge::pipeline_can_enter(pge::STATE_INIT_START,
+		pge::STATE_RASTERIZER, true));
+static_assert(pge::pipeline_can_enter(pge::STATE_RASTERIZER,
+		pge::STATE_INIT_DONE, true));
+static_assert(!pge::pipeline_can_enter(pge::STATE_VERTEX_SHADER,
+		pge::STATE_VERTEX_SHADER, true));
+static_assert(!pge::pipeline_can_enter(pge::STATE_RASTERIZER,
+		pge::STATE_VIEWPORT, true));
+
+static int test_render_pass() {
+	auto def = pge::RenderPass::get_default(VK_FORMAT_B8G8R8A8_SRGB);
+	auto deferred = pge::RenderPass::get_deferred(VK_FORMAT_B8G8R8A8_SRGB,
+			{ VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R8G8B8A8_UNORM });
+
+	/* the presented attachment then the transient gbuffer */
+	if (deferred.attachments.size() != 3 || deferred.subpasses.size() != 2)
+		return -1;
+	if (deferred.attachments[0].transient ||
+			deferred.attachments[0].store_op != VK_ATTACHMENT_STORE_OP_STORE)
+		return -1;
+	for (uint32_t i = 1; i < 3; i++) {
+		auto &&att = deferred.attachments[i];
+		if (!att.transient || att.store_op != VK_ATTACHMENT_STORE_OP_DONT_CARE)
+			return -1;
+	}
+	auto &&geometry = deferred.subpasses[0];
+	auto &&lighting = deferred.subpasses[1];
+	if (geometry.color_refs.size() != 2 || geometry.input_refs.size() ||
+			geometry.color_refs[0].attachment != 1)
+		return -1;
+	if (lighting.input_refs.size() != 2 || lighting.color_refs.size() != 1 ||
+			lighting.color_refs[0].attachment != 0)
+		return -1;
+	if (geometry.has_depth() || lighting.has_depth())
+		return -1;
+
+	/* external -> 0, external -> 1, then 0 -> 1 by region */
+	if (deferred.dependencies.size() != 3)
+		return -1;
+	auto &&gbuf_dep = deferred.dependencies[2];
+	if (gbuf_dep.srcSubpass != 0 || gbuf_dep.dstSubpass != 1 ||
+			gbuf_dep.dstAccessMask != VK_ACCESS_INPUT_ATTACHMENT_READ_BIT ||
+			!(gbuf_dep.dependencyFlags & VK_DEPENDENCY_BY_REGION_BIT))
+		return -1;
+
+	if (deferred.get_usage(0) != VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
+		return -1;
+	if (deferred.get_usage(1) != (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+			VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT |
+			VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT))
+		return -1;
+
+	/* transient alone isn't a valid usage */
+	auto unused = def;
+	unused.attachments.push_back(pge::attachment_info_t{
+		.format = VK_FORMAT_R8G8B8A8_UNORM,
+		.store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		.transient = VK_TRUE,
+	});
+	if (unused.get_usage(1) != 0)
+		return -1;
+
+	/* the hash only depends on the description */
+	auto same = pge::RenderPass::get_deferred(VK_FORMAT_B8G8R8A8_SRGB,
+			{ VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R8G8B8A8_UNORM });
+	if (same.get_hash() != deferred.get_hash())
+		return -1;
+	if (def.get_hash() == deferred.get_hash())
+		return -1;
+	if (def.get_hash() != pge::RenderPass::get_default(
+			VK_FORMAT_B8G8R8A8_SRGB).get_hash())
+		return -1;
+	if (def.get_hash() == pge::RenderPass::get_default(
+			VK_FORMAT_R8G8B8A8_UNORM).get_hash())
+		return -1;
+
+	/* the depth goes to every subpass and every dependency covers it */
+	same.add_depth(VK_FORMAT_D24_UNORM_S8_UINT);
+	if (same.get_hash() == deferred.get_hash())
+		return -1;
+	if (same.attachments.size() != 4)
+		return -1;
+	auto &&depth = same.attachments[3];
+	if (!depth.transient || depth.store_op != VK_ATTACHMENT_STORE_OP_DONT_CARE ||
+			depth.stencil_load_op != VK_ATTACHMENT_LOAD_OP_CLEAR)
+		return -1;
+	for (auto &&subpass : same.subpasses)
+		if (subpass.depth_ref.attachment != 3)
+			return -1;
+	for (auto &&dep : same.dependencies)
+		if (!(dep.srcStageMask & VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT) ||
+				!(dep.srcAccessMask &
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT) ||
+				!(dep.dstAccessMask &
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT))
+			return -1;
+	if (same.get_usage(3) != (VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+			VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT))
+		return -1;
+
+	/* a kept depth is stored and has no stencil for a depth only format */
+	def.add_depth(VK_FORMAT_D32_SFLOAT, false);
+	auto &&kept = def.attachments[1];
+	if (kept.transient || kept.store_op != VK_ATTACHMENT_STORE_OP_STORE ||
+			kept.stencil_store_op != VK_ATTACHMENT_STORE_OP_DONT_CARE)
+		return -1;
+	if (def.get_usage(1) != VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
+		return -1;
+	return 0;
+}
+
+/* a version with cnt push ranges, to tell them apart */
+static std::shared_ptr<pge::PipelineDataScope> make_version(uint32_t cnt) {
+	auto data = std::make_shared<pge::PipelineDataScope>(nullptr);
+	data->push_ranges.resize(cnt);
+	return data;
+}
+
+static int test_publish() {
+	pge::RetireQueue retire;
+	pge::PipelineVersions versions(&retire);
+	if (versions.is_ready() || versions.get())
+		return -1;
+
+	retire.begin_frame(1);
+	auto first = make_version(1);
+	std::weak_ptr<pge::PipelineDataScope> first_ref = first;
+	versions.publish(std::move(first));
+	if (!versions.is_ready() || versions.get() != first_ref.lock().get())
+		return -1;
+	if (retire.size())
+		return -1;
+
+	/* frame 1 may still draw with the first version */
+	versions.publish(make_version(2));
+	if (versions.get()->push_ranges.size() != 2 || retire.size() != 1)
+		return -1;
+	retire.begin_frame(2);
+	retire.frame_completed(0);
+	if (first_ref.expired())
+		return -1;
+	retire.frame_completed(1);
+	if (!first_ref.expired() || retire.size())
+		return -1;
+
+	/* the reader always sees a complete version */
+	std::atomic<bool> done = false;
+	std::atomic<bool> torn = false;
+	std::thread reader([&] {
+		while (!done) {
+			auto data = versions.get();
+			if (!data || data->push_ranges.size() < 2)
+				torn = true;
+		}
+	});
+	for (uint32_t i = 3; i < 1000; i++)
+		versions.publish(make_version(i));
+	done = true;
+	reader.join();
+	if (torn || retire.size() != 997)
+		return -1;
+	retire.frame_completed(2);
+	if (retire.size())
+		return -1;
+
+	/* the last version of a destroyed pipeline may still be in flight */
+	std::weak_ptr<pge::PipelineDataScope> last_ref;
+	{
+		pge::PipelineVersions destroyed(&retire);
+		auto last = make_version(1);
+		last_ref = last;
+		destroyed.publish(std::move(last));
+	}
+	if (last_ref.expired() || retire.size() != 1)
+		return -1;
+	retire.frame_completed(2);
+	if (!last_ref.expired())
+		return -1;
+
+	/* the window clears what is left once the device is idle */
+	versions.publish(make_version(2));
+	if (retire.size() != 1)
+		return -1;
+	retire.clear();
+	if (retire.size())
+		return -1;
+
+	/* without a queue nothing can be in flight */
+	pge::PipelineVersions unqueued;
+	auto replaced = make_version(1);
+	std::weak_ptr<pge::PipelineDataScope> replaced_ref = replaced;
+	unqueued.publish(std::move(replaced));
+	unqueued.publish(make_version(2));
+	if (!replaced_ref.expired())
+		return -1;
+	return 0;
+}
+
+static int test_split_push() {
+	auto range = [](VkShaderStageFlags stages, uint32_t offset, uint32_t size) {
+		return VkPushConstantRange{
+			.stageFlags = stages,
+			.offset = offset,
+			.size = size,
+		};
+	};
+	auto same = [](const pge::push_parts_t& parts,
+			std::vector<VkPushConstantRange> expect)
+	{
+		if (parts.cnt != expect.size())
+			return false;
+		for (uint32_t i = 0; i < parts.cnt; i++)
+			if (parts.parts[i].stageFlags != expect[i].stageFlags ||
+					parts.parts[i].offset != expect[i].offset ||
+					parts.parts[i].size != expect[i].size)
+				return false;
+		return true;
+	};
+	auto throws = [](auto &&fn) {
+		try {
+			fn();
+		}
+		catch (std::exception& e) {
+			DBG("Intentional error: %s", e.what());
+			return true;
+		}
+		return false;
+	};
+	const auto VERT = VK_SHADER_STAGE_VERTEX_BIT;
+	const auto FRAG = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	/* one range holds the push */
+	std::vector<VkPushConstantRange> single = { range(VERT | FRAG, 0, 64) };
+	if (!same(pge::split_push(single, 16, 16), { range(VERT | FRAG, 16, 16) }))
+		return -1;
+
+	/* two ranges holding the whole push, no split */
+	std::vector<VkPushConstantRange> both = {
+		range(VERT, 0, 64), range(FRAG, 0, 32) };
+	if (!same(pge::split_push(both, 0, 32), { range(VERT | FRAG, 0, 32) }))
+		return -1;
+
+	/* overlapping ranges, split where the fragment range starts and ends */
+	std::vector<VkPushConstantRange> overlap = {
+		range(VERT, 0, 64), range(FRAG, 16, 16) };
+	if (!same(pge::split_push(overlap, 0, 64), { range(VERT, 0, 16),
+			range(VERT | FRAG, 16, 16), range(VERT, 32, 32) }))
+		return -1;
+
+	/* adjacent ranges, split at the shared edge */
+	std::vector<VkPushConstantRange> adjacent = {
+		range(VERT, 0, 16), range(FRAG, 16, 16) };
+	if (!same(pge::split_push(adjacent, 8, 16), { range(VERT, 8, 8),
+			range(FRAG, 16, 8) }))
+		return -1;
+
+	/* the same edge from two ranges is only used once */
+	std::vector<VkPushConstantRange> shared_edge = { range(VERT, 0, 16),
+		range(FRAG, 0, 16), range(VK_SHADER_STAGE_GEOMETRY_BIT, 16, 16) };
+	if (!same(pge::split_push(shared_edge, 0, 32), { range(VERT | FRAG, 0, 16),
+			range(VK_SHADER_STAGE_GEOMETRY_BIT, 16, 16) }))
+		return -1;
+
+	/* a gap, bytes past the end, no range and bad alignment */
+	std::vector<VkPushConstantRange> gap = {
+		range(VERT, 0, 16), range(FRAG, 32, 16) };
+	if (!throws([&] { pge::split_push(gap, 0, 48); }))
+		return -1;
+	if (!throws([&] { pge::split_push(single, 48, 32); }))
+		return -1;
+	if (!throws([&] { pge::split_push({}, 0, 4); }))
+		return -1;
+	if (!throws([&] { pge::split_push(single, 2, 4); }))
+		return -1;
+	if (!throws([&] { pge::split_push(single, 0, 6); }))
+		return -1;
+	return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+	if (test_render_pass() != 0) {
+		DBG("Render pass description failed");
+		return -1;
+	}
+	if (test_split_push() != 0) {
+		DBG("Push constant split failed");
+		return -1;
+	}
+	if (test_publish() != 0) {
+		DBG("Pipeline publish failed");
+		return -1;
+	}
+	return 0;
+}
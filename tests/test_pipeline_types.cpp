@@ -0,0 +1,332 @@
+#include "pge_pipeline.h"
+#include "pge_compute.h"
+
+/* The pipeline builder without a window: the creators must chain in the order
+of the states and reject the stages out of order at compile time. Nothing is
+created, end_pipeline is called with create_it = false. The order rules
+themselves are checked by test_pipeline, this checks the creators follow them */
+
+using pge::DrawPipeline;
+using pge::PipelineState;
+
+template <PipelineState state, bool derived = false>
+using creator_t = DrawPipeline::PipelineCreator<state, derived>;
+
+template <typename C>
+concept can_add_vertex_shader = requires (C c) {
+	c.add_vertex_shader(pge::vert_shader_info_t{});
+};
+
+template <typename C>
+concept can_add_tessellation = requires (C c) { c.add_tessellation(); };
+
+template <typename C>
+concept can_add_rasterizer = requires (C c) { c.add_rasterizer(); };
+
+template <typename C>
+concept can_add_fragment_shader = requires (C c) {
+	c.add_fragment_shader(pge::frag_shader_info_t{});
+};
+
+template <typename C>
+concept can_end_pipeline = requires (C c) { c.end_pipeline(false); };
+
+/* the stages keep their order */
+static_assert(!can_add_vertex_shader<creator_t<pge::STATE_RASTERIZER>>);
+static_assert(!can_add_vertex_shader<creator_t<pge::STATE_RASTERIZER, true>>);
+static_assert(!can_add_rasterizer<creator_t<pge::STATE_RASTERIZER>>);
+static_assert(!can_add_tessellation<creator_t<pge::STATE_GEOMETRY_SHADER>>);
+
+/* a full pipeline can't skip a stage that isn't optional */
+static_assert(!can_add_rasterizer<creator_t<pge::STATE_INIT_START>>);
+static_assert(!can_add_fragment_shader<creator_t<pge::STATE_RASTERIZER>>);
+static_assert(!can_end_pipeline<creator_t<pge::STATE_LAYOUTS>>);
+static_assert(can_add_vertex_shader<creator_t<pge::STATE_VIEWPORT>>);
+static_assert(can_add_rasterizer<creator_t<pge::STATE_VERTEX_SHADER>>);
+static_assert(can_add_fragment_shader<creator_t<pge::STATE_MULTISAMPLER>>);
+static_assert(can_add_tessellation<creator_t<pge::STATE_VERTEX_SHADER>>);
+static_assert(can_end_pipeline<creator_t<pge::STATE_RENDER_PASS>>);
+
+/* a derived one only keeps the order */
+static_assert(can_add_rasterizer<creator_t<pge::STATE_INIT_START, true>>);
+static_assert(can_end_pipeline<creator_t<pge::STATE_RASTERIZER, true>>);
+
+/* any word is fine, the bytecode isn't looked at without a device */
+static pge::shader_info_t get_dummy_shader(uint32_t word) {
+	return pge::shader_info_t{
+		.load_type = pge::SHADER_LOAD_BYTECODE,
+		.name = "dummy",
+		.bytecode = { 0x07230203, word },
+	};
+}
+
+static pge::viewport_info_t get_viewport() {
+	return pge::viewport_info_t{
+		.viewport = {
+			.x = 0.0f,
+			.y = 0.0f,
+			.width = 64.0f,
+			.height = 64.0f,
+			.minDepth = 0.0f,
+			.maxDepth = 1.0f,
+		},
+		.scissor = {
+			.offset = {0, 0},
+			.extent = {64, 64},
+		},
+	};
+}
+
+static pge::render_pass_info_t get_render_pass() {
+	auto render_pass = pge::RenderPass::get_default(VK_FORMAT_B8G8R8A8_SRGB);
+	render_pass.add_depth(VK_FORMAT_D32_SFLOAT);
+	return pge::render_pass_info_t{ .render_pass = render_pass };
+}
+
+/* every stage, the optional ones included. A strip with primitive restart,
+that the tessellation replaces by patches */
+static void describe_full(DrawPipeline &pipeline, bool tessellation = true) {
+	pipeline.begin_pipeline(pge::base_pipeline_info_t{
+				.async_shaders = false,
+				.allow_derivatives = true,
+			})
+			.add_vertex_input()
+			.add_input_assembly(pge::topology_info_t{
+				.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+				.restart_enable = true,
+			})
+			.add_viewport(get_viewport())
+			.add_vertex_shader({ get_dummy_shader(1) })
+			.add_tessellation(tessellation ? pge::tess_info_t{
+				.control = get_dummy_shader(2),
+				.evaluation = get_dummy_shader(3),
+				.patch_control_points = 4,
+			} : pge::tess_info_t{ .use_defaults = true })
+			.add_geometry_shader()
+			.add_rasterizer()
+			.add_multisampler()
+			.add_fragment_shader({ get_dummy_shader(4) })
+			.add_depth_stencil()
+			.add_color_blending()
+			.add_layouts()
+			.add_render_pass(get_render_pass())
+			.end_pipeline(false);
+}
+
+static int test_chain() {
+	DrawPipeline full(nullptr);
+	describe_full(full);
+	if (full.get_stages().size() != 4)
+		return -1;
+
+	/* the wireframe variant only changes the rasterizer */
+	DrawPipeline wireframe(nullptr);
+	wireframe.derive_pipeline(full)
+			.add_rasterizer(pge::rasterizer_info_t{
+				.poly_mode = VK_POLYGON_MODE_LINE,
+			})
+			.end_pipeline(false);
+	if (wireframe.base != &full || wireframe.get_stages().size() != 4)
+		return -1;
+	return 0;
+}
+
+static int test_tessellation() {
+	DrawPipeline tess(nullptr);
+	describe_full(tess);
+	auto stages = tess.get_stages();
+	VkShaderStageFlagBits expected[] = {
+		VK_SHADER_STAGE_VERTEX_BIT,
+		VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+		VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+		VK_SHADER_STAGE_FRAGMENT_BIT,
+	};
+	if (stages.size() != 4)
+		return -1;
+	for (int i = 0; i < 4; i++)
+		if (stages[i].stage != expected[i])
+			return -1;
+
+	/* patches, never restarted */
+	if (tess.get_topology() != VK_PRIMITIVE_TOPOLOGY_PATCH_LIST ||
+			tess.get_restart_enable())
+		return -1;
+	auto b = tess.describe_build();
+	if (b->topol_cfg.topology != VK_PRIMITIVE_TOPOLOGY_PATCH_LIST ||
+			b->topol_cfg.primitiveRestartEnable)
+		return -1;
+	if (!b->pipeline_cfg.pTessellationState ||
+			b->pipeline_cfg.pTessellationState->patchControlPoints != 4)
+		return -1;
+	if (b->pipeline_cfg.stageCount != 4 ||
+			b->shader_stages[1].stage != expected[1])
+		return -1;
+
+	/* the same description, without the stage */
+	DrawPipeline plain(nullptr);
+	describe_full(plain, false);
+	if (plain.get_stages().size() != 2)
+		return -1;
+	if (plain.get_topology() != VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP ||
+			!plain.get_restart_enable())
+		return -1;
+	b = plain.describe_build();
+	if (b->pipeline_cfg.pTessellationState ||
+			!b->topol_cfg.primitiveRestartEnable)
+		return -1;
+
+	DrawPipeline same(nullptr);
+	describe_full(same);
+	if (tess.get_state_hash() != same.get_state_hash())
+		return -1;
+	if (tess.get_state_hash() == plain.get_state_hash())
+		return -1;
+
+	/* described again, the stage of the previous description is gone */
+	describe_full(same, false);
+	if (same.get_state_hash() != plain.get_state_hash())
+		return -1;
+	return 0;
+}
+
+/* a material drawn after it's pre-pass */
+static void describe_material(DrawPipeline &pipeline,
+		pge::render_pass_info_t render_pass)
+{
+	pipeline.begin_pipeline(pge::base_pipeline_info_t{
+				.async_shaders = false,
+				.allow_derivatives = true,
+			})
+			.add_vertex_input()
+			.add_input_assembly()
+			.add_viewport(get_viewport())
+			.add_vertex_shader({ get_dummy_shader(1) })
+			.add_rasterizer()
+			.add_multisampler()
+			.add_fragment_shader({ get_dummy_shader(4) })
+			.add_depth_stencil(pge::depth_stencil_info_t::get_after_prepass())
+			.add_color_blending()
+			.add_layouts()
+			.add_render_pass(render_pass)
+			.end_pipeline(false);
+}
+
+static int test_prepass() {
+	DrawPipeline material(nullptr);
+	describe_material(material, get_render_pass());
+
+	/* the material only tests the depth written by the pre-pass */
+	auto b = material.describe_build();
+	auto depth = b->pipeline_cfg.pDepthStencilState;
+	if (!depth || !depth->depthTestEnable || depth->depthWriteEnable ||
+			depth->depthCompareOp != VK_COMPARE_OP_EQUAL)
+		return -1;
+	if (b->color_blend_attachments.size() != 1 ||
+			!b->color_blend_attachments[0].colorWriteMask)
+		return -1;
+
+	/* no fragment stage and no color writes */
+	DrawPipeline prepass(nullptr);
+	prepass.depth_prepass_of(material, false);
+	auto stages = prepass.get_stages();
+	if (stages.size() != 1 || stages[0].stage != VK_SHADER_STAGE_VERTEX_BIT)
+		return -1;
+	b = prepass.describe_build();
+	depth = b->pipeline_cfg.pDepthStencilState;
+	if (!depth || !depth->depthTestEnable || !depth->depthWriteEnable ||
+			depth->depthCompareOp != VK_COMPARE_OP_LESS)
+		return -1;
+	if (b->pipeline_cfg.stageCount != 1 ||
+			b->color_blend_attachments.size() != 1 ||
+			b->color_blend_attachments[0].colorWriteMask)
+		return -1;
+	if (prepass.get_state_hash() == material.get_state_hash())
+		return -1;
+
+	/* a derivative only once the material is created */
+	if (prepass.base || (b->pipeline_cfg.flags &
+			VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT))
+		return -1;
+	material.publish(std::make_shared<pge::PipelineDataScope>(nullptr));
+	prepass.depth_prepass_of(material, false);
+	if (prepass.base != &material)
+		return -1;
+
+	/* nor when the material can't be a base */
+	DrawPipeline alone(nullptr);
+	describe_material(alone, get_render_pass());
+	alone._base_pipeline_info.allow_derivatives = false;
+	alone.publish(std::make_shared<pge::PipelineDataScope>(nullptr));
+	prepass.depth_prepass_of(alone, false);
+	if (prepass.base)
+		return -1;
+
+	/* there is nothing to pre-pass into without a depth attachment */
+	DrawPipeline no_depth(nullptr);
+	describe_material(no_depth, pge::render_pass_info_t{
+		.render_pass = pge::RenderPass::get_default(VK_FORMAT_B8G8R8A8_SRGB),
+	});
+	bool failed = false;
+	try {
+		prepass.depth_prepass_of(no_depth, false);
+	}
+	catch (std::exception& e) {
+		DBG("Intentional error: %s", e.what());
+		failed = true;
+	}
+	if (!failed)
+		return -1;
+	return 0;
+}
+
+/* variants recompile the GLSL with other defines, bytecode has none left */
+static int test_variants() {
+	std::vector<std::string> keys = { "USE_FOG", "USE_SHADOWS" };
+	for (auto load_type : { pge::SHADER_LOAD_BYTECODE,
+			pge::SHADER_LOAD_BYTECODE_PATH, pge::SHADER_LOAD_PACK })
+	{
+		auto base = get_dummy_shader(1);
+		base.load_type = load_type;
+		bool failed = false;
+		try {
+			pge::ShaderVariants variants(base, SHC_VERTEX_SHADER, keys);
+		}
+		catch (std::exception& e) {
+			DBG("Intentional error: %s", e.what());
+			failed = true;
+		}
+		if (!failed)
+			return -1;
+	}
+
+	/* nothing is compiled before a variant is requested */
+	pge::ShaderVariants variants(pge::shader_info_t{
+		.load_type = pge::SHADER_LOAD_SRC,
+		.name = "dummy",
+		.code = "void main() {}",
+	}, SHC_VERTEX_SHADER, keys);
+	if (variants.get_mask({ "USE_SHADOWS" }) != 2)
+		return -1;
+	return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+	if (test_chain() != 0) {
+		DBG("Pipeline creator chain failed");
+		return -1;
+	}
+	if (test_tessellation() != 0) {
+		DBG("Tessellation state failed");
+		return -1;
+	}
+	if (test_prepass() != 0) {
+		DBG("Depth pre-pass failed");
+		return -1;
+	}
+	if (test_variants() != 0) {
+		DBG("Shader variants failed");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,221 @@
+#include "utils.h"
+#include "shader_compile.h"
+
+#include <vector>
+
+static std::vector<uint32_t> compile(ShaderC& shc, const char *path, int kind) {
+	size_t len = 0;
+	uint32_t *code = shc.shc_compile_path_fn(path, kind, &len, true);
+	std::vector<uint32_t> ret(code, code + len);
+	shc.shc_free_shader_fn(code);
+	return ret;
+}
+
+/* compares building a new compiler context for every shader, like the lib used
+to do, with reusing a single context */
+static int bench_ctx(ShaderC& shc, int iters) {
+	const char *path = "shaders/test_shader.frag";
+
+	pge::TimePointMs fresh_time;
+	for (int i = 0; i < iters; i++) {
+		size_t len = 0;
+		shc_ctx_t *ctx = shc.shc_create_ctx_fn();
+		uint32_t *code = shc.shc_ctx_compile_path_fn(ctx, path,
+				SHC_FRAGMENT_SHADER, &len, true);
+		shc.shc_free_shader_fn(code);
+		shc.shc_destroy_ctx_fn(ctx);
+		if (!len)
+			return -1;
+	}
+	uint64_t fresh_ms = fresh_time.elapsed();
+
+	pge::TimePointMs reused_time;
+	shc_ctx_t *ctx = shc.shc_create_ctx_fn();
+	for (int i = 0; i < iters; i++) {
+		size_t len = 0;
+		uint32_t *code = shc.shc_ctx_compile_path_fn(ctx, path,
+				SHC_FRAGMENT_SHADER, &len, true);
+		shc.shc_free_shader_fn(code);
+		if (!len)
+			return -1;
+	}
+	shc.shc_destroy_ctx_fn(ctx);
+	uint64_t reused_ms = reused_time.elapsed();
+
+	DBG("per shader cost: new ctx: %.3f ms, reused ctx: %.3f ms",
+			fresh_ms / (double)iters, reused_ms / (double)iters);
+	return 0;
+}
+
+/* the last job is intentionally broken and must come back with a diagnostic */
+static int test_batch(ShaderC& shc, int copies) {
+	shc_define_t defines[] = { {"PGE_TEST_DEFINE", "1"} };
+	std::vector<shc_job_t> jobs;
+	for (int i = 0; i < copies; i++) {
+		jobs.push_back(shc_job_t{ .path = "shaders/test_shader.vert",
+				.kind = SHC_VERTEX_SHADER, .opt_level = SHC_OPT_PERFORMANCE });
+		jobs.push_back(shc_job_t{ .path = "shaders/test_shader.frag",
+				.kind = SHC_FRAGMENT_SHADER, .defines = defines,
+				.define_cnt = 1, .opt_level = SHC_OPT_PERFORMANCE });
+	}
+	jobs.push_back(shc_job_t{ .name = "broken", .src = "void main() { x }",
+			.kind = SHC_FRAGMENT_SHADER });
+
+	pge::TimePointMs batch_time;
+	int failed = shc.shc_compile_batch_fn(jobs.data(), jobs.size());
+	DBG("batch of %ld shaders: %ld ms", jobs.size(), batch_time.elapsed());
+
+	int ret = 0;
+	if (failed != 1 || jobs.back().result || !jobs.back().diag)
+		ret = -1;
+	else
+		DBG("Intentional compile error: %s", jobs.back().diag);
+	shc.shc_free_batch_fn(jobs.data(), jobs.size());
+	return ret;
+}
+
+/* SPIR-V size and compile time of every level, with and without the extra
+passes. The driver side of it is measured in test_vulkan. */
+static int bench_opt_levels(ShaderC& shc, int iters) {
+	const char *names[] = { "zero", "size", "performance" };
+	for (int level = SHC_OPT_ZERO; level <= SHC_OPT_PERFORMANCE; level++) {
+		for (uint32_t passes : { 0u, (uint32_t)SHC_PASS_DCE }) {
+			shc_opts_t opts{ .kind = SHC_FRAGMENT_SHADER, .opt_level = level,
+					.passes = passes };
+			std::vector<uint32_t> code;
+			pge::TimePointMs time;
+			for (int i = 0; i < iters; i++)
+				if (shc.compile_path("shaders/test_shader.frag", opts, code)
+						!= SHC_OK)
+					return -1;
+			DBG("%-11s %-4s: %5ld bytes, %.3f ms per shader", names[level],
+					passes ? "+dce" : "", code.size() * sizeof(uint32_t),
+					time.elapsed() / (double)iters);
+		}
+	}
+	shc_opts_t bad{ .kind = SHC_FRAGMENT_SHADER, .opt_level = 42 };
+	std::vector<uint32_t> code;
+	if (shc.compile_path("shaders/test_shader.frag", bad, code) !=
+			SHC_ERR_ARGS)
+		return -1;
+	return 0;
+}
+
+/* the SPIR-V is written directly in the caller's vector */
+static int test_compile_to(ShaderC& shc) {
+	std::vector<uint32_t> code;
+	shc_opts_t opts{ .kind = SHC_VERTEX_SHADER,
+			.opt_level = SHC_OPT_PERFORMANCE };
+	if (shc.compile_path("shaders/test_shader.vert", opts, code) != SHC_OK ||
+			code.empty())
+		return -1;
+	if (shc.compile_path("shaders/missing.vert", opts, code) != SHC_ERR_IO)
+		return -1;
+	if (shc.compile_src("broken", "void main() { x }", opts, code) !=
+			SHC_ERR_COMPILE)
+		return -1;
+	return 0;
+}
+
+static void write_file(const std::string& path, const std::string& content) {
+	std::ofstream out(path);
+	out << content;
+}
+
+/* needs the cache enabled, editing the header must invalidate the entry */
+static int test_includes(ShaderC& shc, const std::string& dir) {
+	std::string text = "#version 450\n#extension GL_GOOGLE_include_directive"
+			" : require\n#include \"common.glsl\"\nlayout(location = 0) out "
+			"vec4 color;\nvoid main() { color = PGE_COLOR; }\n";
+	std::string shader = dir + "include_test.frag";
+	write_file(dir + "common.glsl", "#define PGE_COLOR vec4(1.0)\n");
+	write_file(shader, text);
+
+	auto first = compile(shc, shader.c_str(), SHC_FRAGMENT_SHADER);
+	auto cached = compile(shc, shader.c_str(), SHC_FRAGMENT_SHADER);
+	write_file(dir + "common.glsl", "#define PGE_COLOR vec4(0.5)\n");
+	auto changed = compile(shc, shader.c_str(), SHC_FRAGMENT_SHADER);
+
+	if (first.empty() || first != cached || first == changed)
+		return -1;
+
+	/* the same text next to different headers */
+	std::vector<uint32_t> sibling_spv[2];
+	for (int i = 0; i < 2; i++) {
+		std::string sub = dir + "sibling" + std::to_string(i) + "/";
+		std::filesystem::create_directories(sub);
+		write_file(sub + "common.glsl", "#define PGE_COLOR vec4(" +
+				std::to_string(i) + ".0)\n");
+		write_file(sub + "include_test.frag", text);
+		sibling_spv[i] = compile(shc, (sub + "include_test.frag").c_str(),
+				SHC_FRAGMENT_SHADER);
+	}
+	if (sibling_spv[0].empty() || sibling_spv[0] == sibling_spv[1])
+		return -1;
+	return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+	ShaderC shc;
+	if (shc.load("./libshc.so") != 0) {
+		DBG("Couldn't load shader compiler lib");
+		return -1;
+	}
+
+	if (bench_ctx(shc, 50) != 0) {
+		DBG("Failed to compile with a compiler context");
+		return -1;
+	}
+
+	if (test_compile_to(shc) != 0) {
+		DBG("Compiling into a caller buffer failed");
+		return -1;
+	}
+
+	if (bench_opt_levels(shc, 20) != 0) {
+		DBG("Optimization levels failed");
+		return -1;
+	}
+
+	if (test_batch(shc, 32) != 0) {
+		DBG("Batch compilation failed");
+		return -1;
+	}
+
+	const char *cache_dir = "/tmp/pge_test_shader_cache/";
+	std::filesystem::remove_all(cache_dir);
+	if (shc.shc_set_cache_dir_fn(cache_dir) != 0) {
+		DBG("Couldn't set the shader cache dir");
+		return -1;
+	}
+
+	pge::TimePointMs cold_time;
+	auto cold_vert = compile(shc, "shaders/test_shader.vert", SHC_VERTEX_SHADER);
+	auto cold_frag = compile(shc, "shaders/test_shader.frag", SHC_FRAGMENT_SHADER);
+	DBG("cold compile: %ld ms", cold_time.elapsed());
+
+	pge::TimePointMs warm_time;
+	auto warm_vert = compile(shc, "shaders/test_shader.vert", SHC_VERTEX_SHADER);
+	auto warm_frag = compile(shc, "shaders/test_shader.frag", SHC_FRAGMENT_SHADER);
+	DBG("warm compile: %ld ms", warm_time.elapsed());
+
+	if (cold_vert.empty() || cold_frag.empty()) {
+		DBG("Failed to compile the test shaders");
+		return -1;
+	}
+	if (cold_vert != warm_vert || cold_frag != warm_frag) {
+		DBG("Cached shaders differ from the compiled ones");
+		return -1;
+	}
+
+	if (test_includes(shc, cache_dir) != 0) {
+		DBG("Header changes didn't invalidate the cache");
+		return -1;
+	}
+
+	shc.shc_set_cache_dir_fn(nullptr);
+	std::filesystem::remove_all(cache_dir);
+	shc.unload();
+	return 0;
+}
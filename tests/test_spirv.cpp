@@ -0,0 +1,279 @@
+#include "utils.h"
+#include "pge_spirv.h"
+#include "pge_shader_pack.h"
+
+#include <vector>
+
+/* a valid header followed by OpNop instructions */
+static std::vector<uint32_t> make_module(size_t word_cnt) {
+	std::vector<uint32_t> code = { pge::SPIRV_MAGIC, 0x00010300, 0, 16, 0 };
+	code.resize(word_cnt, 0x00010000);
+	return code;
+}
+
+/* the way SHADER_LOAD_BYTECODE_PATH used to read the files */
+static std::vector<uint32_t> stream_load(const std::string& path) {
+	std::ifstream input(path, std::ios::binary);
+	std::vector<char> bytes(
+			(std::istreambuf_iterator<char>(input)),
+			(std::istreambuf_iterator<char>()));
+	std::vector<uint32_t> code(bytes.size() / 4 + !!(bytes.size() % 4));
+	memcpy(code.data(), bytes.data(), bytes.size());
+	return code;
+}
+
+/* stands in for the driver reading the module */
+static uint64_t consume(const uint32_t *code, size_t word_cnt) {
+	uint64_t sum = 0;
+	for (size_t i = 0; i < word_cnt; i++)
+		sum += code[i];
+	return sum;
+}
+
+static int test_validate() {
+	auto code = make_module(64);
+	if (!pge::spirv_validate(code.data(), code.size()))
+		return -1;
+
+	std::string err;
+	if (pge::spirv_validate(code.data(), 3, &err))
+		return -1;
+	DBG("Intentional error: %s", err);
+
+	code[0] = __builtin_bswap32(pge::SPIRV_MAGIC);
+	if (pge::spirv_validate(code.data(), code.size(), &err))
+		return -1;
+	DBG("Intentional error: %s", err);
+
+	code[0] = pge::SPIRV_MAGIC;
+	code[1] = 0x00020000;
+	if (pge::spirv_validate(code.data(), code.size(), &err))
+		return -1;
+	DBG("Intentional error: %s", err);
+	return 0;
+}
+
+/* layout(push_constant) uniform pc_t { mat4 model; vec4 color; } */
+static int test_push_constants() {
+	auto op = [](uint32_t opcode, std::vector<uint32_t> args) {
+		args.insert(args.begin(), (uint32_t(args.size() + 1) << 16) | opcode);
+		return args;
+	};
+	std::vector<uint32_t> code = { pge::SPIRV_MAGIC, 0x00010000, 0, 16, 0 };
+	for (auto &&inst : {
+		op(72, {4, 0, 35, 0}),      // OpMemberDecorate %4 0 Offset 0
+		op(72, {4, 0, 7, 16}),      // OpMemberDecorate %4 0 MatrixStride 16
+		op(72, {4, 1, 35, 64}),     // OpMemberDecorate %4 1 Offset 64
+		op(22, {1, 32}),            // %1 = OpTypeFloat 32
+		op(23, {2, 1, 4}),          // %2 = OpTypeVector %1 4
+		op(24, {3, 2, 4}),          // %3 = OpTypeMatrix %2 4
+		op(30, {4, 3, 2}),          // %4 = OpTypeStruct %3 %2
+		op(32, {5, 9, 4}),          // %5 = OpTypePointer PushConstant %4
+		op(59, {5, 6, 9}),          // %6 = OpVariable %5 PushConstant
+	})
+		code.insert(code.end(), inst.begin(), inst.end());
+
+	pge::spirv_push_range_t range;
+	if (!pge::spirv_reflect_push_constants(code.data(), code.size(), range) ||
+			range.offset != 0 || range.size != 80)
+		return -1;
+
+	auto no_push = make_module(64);
+	if (pge::spirv_reflect_push_constants(no_push.data(), no_push.size(),
+			range))
+		return -1;
+
+	/* { vec4 color; bool flag; }, a bool takes 4 bytes */
+	std::vector<uint32_t> with_bool = { pge::SPIRV_MAGIC, 0x00010000, 0, 16, 0 };
+	for (auto &&inst : {
+		op(72, {4, 0, 35, 0}),      // OpMemberDecorate %4 0 Offset 0
+		op(72, {4, 1, 35, 16}),     // OpMemberDecorate %4 1 Offset 16
+		op(22, {1, 32}),            // %1 = OpTypeFloat 32
+		op(23, {2, 1, 4}),          // %2 = OpTypeVector %1 4
+		op(20, {3}),                // %3 = OpTypeBool
+		op(30, {4, 2, 3}),          // %4 = OpTypeStruct %2 %3
+		op(32, {5, 9, 4}),          // %5 = OpTypePointer PushConstant %4
+		op(59, {5, 6, 9}),          // %6 = OpVariable %5 PushConstant
+	})
+		with_bool.insert(with_bool.end(), inst.begin(), inst.end());
+	if (!pge::spirv_reflect_push_constants(with_bool.data(), with_bool.size(),
+			range) || range.offset != 0 || range.size != 20)
+		return -1;
+
+	/* a member that can't be sized is an error, not a missing block */
+	std::vector<uint32_t> unsized = { pge::SPIRV_MAGIC, 0x00010000, 0, 16, 0 };
+	for (auto &&inst : {
+		op(72, {3, 0, 35, 0}),      // OpMemberDecorate %3 0 Offset 0
+		op(22, {1, 32}),            // %1 = OpTypeFloat 32
+		op(29, {2, 1}),             // %2 = OpTypeRuntimeArray %1
+		op(30, {3, 2}),             // %3 = OpTypeStruct %2
+		op(32, {4, 9, 3}),          // %4 = OpTypePointer PushConstant %3
+		op(59, {4, 5, 9}),          // %5 = OpVariable %4 PushConstant
+	})
+		unsized.insert(unsized.end(), inst.begin(), inst.end());
+	std::string err;
+	if (pge::spirv_reflect_push_constants(unsized.data(), unsized.size(),
+			range, &err) || err.empty())
+		return -1;
+	DBG("Intentional error: %s", err);
+	return 0;
+}
+
+static int test_local_size() {
+	std::vector<uint32_t> code = { pge::SPIRV_MAGIC, 0x00010000, 0, 16, 0,
+			(6 << 16) | 16, 1, 17, 64, 2, 1 };  // OpExecutionMode %1 LocalSize 64 2 1
+	uint32_t size[3];
+	if (!pge::spirv_reflect_local_size(code.data(), code.size(), size) ||
+			size[0] != 64 || size[1] != 2 || size[2] != 1)
+		return -1;
+
+	auto no_size = make_module(64);
+	if (pge::spirv_reflect_local_size(no_size.data(), no_size.size(), size))
+		return -1;
+
+	/* local_size_x_id: a placeholder LocalSize 1 1 1 and the real size in a
+	spec constant composite decorated with BuiltIn WorkgroupSize */
+	std::vector<uint32_t> spec = { pge::SPIRV_MAGIC, 0x00010000, 0, 16, 0,
+			(6 << 16) | 16, 1, 17, 1, 1, 1,     // OpExecutionMode %1 LocalSize 1 1 1
+			(4 << 16) | 71, 5, 11, 25,          // OpDecorate %5 BuiltIn WorkgroupSize
+			(4 << 16) | 50, 2, 3, 64,           // %3 = OpSpecConstant %2 64
+			(6 << 16) | 51, 4, 5, 3, 3, 3 };    // %5 = OpSpecConstantComposite %4 %3 %3 %3
+	if (pge::spirv_reflect_local_size(spec.data(), spec.size(), size))
+		return -1;
+	return 0;
+}
+
+/* an entry whose offset + size wraps around must not pass the bounds check */
+static int test_pack_bounds() {
+	std::string path = "/tmp/pge_bad_pack.pack";
+	pge::shader_pack_header_t header{
+		.magic = pge::SHADER_PACK_MAGIC,
+		.version = pge::SHADER_PACK_VERSION,
+		.entry_cnt = 1,
+	};
+	pge::shader_pack_entry_t entry{
+		.name_hash = pge::fnv1a_64(std::string("bad")),
+		.offset = pge::SHADER_PACK_ALIGN,
+		.size = 32 - pge::SHADER_PACK_ALIGN,  // offset + size wraps to 32
+	};
+	std::vector<uint8_t> file(2 * pge::SHADER_PACK_ALIGN, 0);
+	memcpy(file.data(), &header, sizeof(header));
+	memcpy(file.data() + sizeof(header), &entry, sizeof(entry));
+	if (!pge::write_file_atomic(path, file.data(), file.size()))
+		return -1;
+
+	bool rejected = false;
+	try {
+		pge::ShaderPack pack(path);
+	}
+	catch (std::exception& e) {
+		DBG("Intentional error: %s", e.what());
+		rejected = true;
+	}
+	std::filesystem::remove(path);
+	return rejected ? 0 : -1;
+}
+
+static int test_pack_content() {
+	std::string path = "/tmp/pge_corrupt_pack.pack";
+	auto code = make_module(16);
+	uint64_t code_size = code.size() * sizeof(uint32_t);
+	pge::shader_pack_header_t header{
+		.magic = pge::SHADER_PACK_MAGIC,
+		.version = pge::SHADER_PACK_VERSION,
+		.entry_cnt = 1,
+	};
+	pge::shader_pack_entry_t entry{
+		.name_hash = pge::fnv1a_64(std::string("module")),
+		.content_hash = pge::fnv1a_64(code.data(), code_size),
+		.offset = pge::SHADER_PACK_ALIGN,
+		.size = code_size,
+	};
+	std::vector<uint8_t> file(pge::SHADER_PACK_ALIGN + code_size, 0);
+	memcpy(file.data(), &header, sizeof(header));
+	memcpy(file.data() + sizeof(header), &entry, sizeof(entry));
+	memcpy(file.data() + entry.offset, code.data(), code_size);
+
+	auto opens = [&] {
+		if (!pge::write_file_atomic(path, file.data(), file.size()))
+			return false;
+		try {
+			pge::ShaderPack pack(path);
+			return pack.find("module") != nullptr;
+		}
+		catch (std::exception& e) {
+			DBG("Intentional error: %s", e.what());
+		}
+		return false;
+	};
+
+	/* the intact blob opens, a single flipped bit in it doesn't */
+	bool intact = opens();
+	file[entry.offset + code_size - 1] ^= 1;
+	bool corrupted = opens();
+	std::filesystem::remove(path);
+	return intact && !corrupted ? 0 : -1;
+}
+
+static int bench_load(size_t module_cnt, size_t word_cnt) {
+	std::string dir = "/tmp/pge_spirv_bench/";
+	std::filesystem::create_directories(dir);
+	auto code = make_module(word_cnt);
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < module_cnt; i++) {
+		paths.push_back(dir + std::to_string(i) + ".spv");
+		if (!pge::write_file_atomic(paths.back(), code.data(),
+				code.size() * sizeof(uint32_t)))
+			return -1;
+	}
+
+	uint64_t stream_sum = 0;
+	pge::TimePointMs stream_time;
+	for (auto &&path : paths) {
+		auto loaded = stream_load(path);
+		stream_sum += consume(loaded.data(), loaded.size());
+	}
+	uint64_t stream_ms = stream_time.elapsed();
+
+	uint64_t mmap_sum = 0;
+	pge::TimePointMs mmap_time;
+	for (auto &&path : paths) {
+		auto view = pge::spirv_map_file(path);
+		mmap_sum += consume(view.code, view.word_cnt);
+	}
+	uint64_t mmap_ms = mmap_time.elapsed();
+
+	std::filesystem::remove_all(dir);
+	DBG("%ld modules of %ld bytes: istreambuf: %ld ms, mmap: %ld ms",
+			module_cnt, word_cnt * sizeof(uint32_t), stream_ms, mmap_ms);
+	return stream_sum == mmap_sum ? 0 : -1;
+}
+
+int main(int argc, char const *argv[])
+{
+	if (test_validate() != 0) {
+		DBG("SPIR-V validation failed");
+		return -1;
+	}
+	if (test_push_constants() != 0) {
+		DBG("Push constant reflection failed");
+		return -1;
+	}
+	if (test_local_size() != 0) {
+		DBG("Local size reflection failed");
+		return -1;
+	}
+	if (test_pack_bounds() != 0) {
+		DBG("Shader pack bounds check failed");
+		return -1;
+	}
+	if (test_pack_content() != 0) {
+		DBG("Shader pack content check failed");
+		return -1;
+	}
+	if (bench_load(4000, 4096) != 0) {
+		DBG("SPIR-V load benchmark failed");
+		return -1;
+	}
+	return 0;
+}
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <vector>
 #include <cstring>
+#include <cstdlib>
 #include <set>
 #include <map>
 
@@ -12,6 +13,9 @@
 
 #include "utils.h"
 #include "shader_compile.h"
+#include "pge_pipeline_cache.h"
+#include "pge_pipeline.h"
+#include "pge_compute.h"
 
 /* CONFIG:
 ============================================================================= */
@@ -147,7 +151,435 @@ int rateDeviceSuitability(VkPhysicalDevice device) {
 	return score;
 }
 
+/* OFFSCREEN TESTS:
+============================================================================= */
+
+/* the engine's window without a surface, the tests render to their own
+images */
+static std::unique_ptr<pge::Window> make_headless_window(bool async_compute) {
+	nlohmann::json cfg = {
+		{"width", 64},
+		{"height", 64},
+		{"debug_mode", checkValidationLayerSupport()},
+		{"app_name", "test_vulkan"},
+		{"engine_name", "pge"},
+		{"headless", true},
+		{"async_compute", async_compute},
+	};
+	return std::make_unique<pge::Window>(cfg);
+}
+
+/* the memory types that are not lazily allocated */
+static uint32_t get_eager_memory_types(VkPhysicalDevice phy_dev) {
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceMemoryProperties(phy_dev, &mem_props);
+	uint32_t types = 0;
+	for (uint32_t i = 0; i < mem_props.memoryTypeCount; i++)
+		if (!(mem_props.memoryTypes[i].propertyFlags &
+				VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+			types |= 1 << i;
+	return types;
+}
+
+/* the deferred render pass with a depth attachment, it's framebuffer and the
+recording of both subpasses, nothing is drawn */
+static int test_offscreen_deferred(pge::Window &window) {
+	auto device = window.d->device;
+	auto phy_dev = window.phydev.phy_dev;
+	auto extent = window.phydev.extent;
+
+	auto desc = pge::RenderPass::get_deferred(VK_FORMAT_R8G8B8A8_UNORM,
+			{ VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R8G8B8A8_UNORM });
+	desc.add_depth(VK_FORMAT_D16_UNORM);
+	desc.attachments[0].final_layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	/* the geometry doesn't touch the lit color, that the lighting writes */
+	desc.subpasses[0].preserve_refs = { 0 };
+	for (uint32_t i : {1, 2}) {
+		auto usage = desc.get_usage(i);
+		if (!(usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) ||
+				!(usage & VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT))
+			return -1;
+	}
+
+	pge::RenderPassScope render_pass(&window, desc);
+	if (!render_pass.render_pass)
+		return -1;
+
+	/* the lit color is the only attachment given a view */
+	pge::AttachmentImageScope color(&window, desc.attachments[0],
+			desc.get_usage(0), extent);
+	if (color.lazy || !color.view)
+		return -1;
+	pge::FramebufferScope framebuffer(&window, desc, render_pass.render_pass,
+			extent, { color.view });
+	if (!framebuffer.framebuffer || framebuffer.images.size() != 3)
+		return -1;
+
+	/* lazily allocated memory when the device has some for the image */
+	for (auto &&img : framebuffer.images) {
+		VkMemoryRequirements mem_reqs;
+		vkGetImageMemoryRequirements(device, img->image, &mem_reqs);
+		bool has_lazy = pge::find_memory_type(phy_dev, mem_reqs.memoryTypeBits,
+				VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) >= 0;
+		if (img->lazy != has_lazy || !img->view)
+			return -1;
+	}
+
+	/* without lazily allocated memory it falls back on device local memory */
+	pge::AttachmentImageScope eager(&window, desc.attachments[1],
+			desc.get_usage(1), extent, get_eager_memory_types(phy_dev));
+	if (eager.lazy || !eager.view)
+		return -1;
+
+	/* no memory at all, the image made before the failure is released */
+	bool failed = false;
+	try {
+		pge::AttachmentImageScope no_memory(&window, desc.attachments[1],
+				desc.get_usage(1), extent, 0);
+	}
+	catch (std::exception& e) {
+		DBG("Intentional error: %s", e.what());
+		failed = true;
+	}
+	if (!failed)
+		return -1;
+
+	/* a view that has no attachment */
+	failed = false;
+	try {
+		pge::FramebufferScope extra(&window, desc, render_pass.render_pass,
+				extent, { color.view, color.view });
+	}
+	catch (std::exception& e) {
+		DBG("Intentional error: %s", e.what());
+		failed = true;
+	}
+	if (!failed)
+		return -1;
+
+	VkCommandPoolCreateInfo pool_info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.queueFamilyIndex = window.phydev.graphic_index,
+	};
+	VkCommandPool cmd_pool;
+	if (vkCreateCommandPool(device, &pool_info, nullptr, &cmd_pool)
+			!= VK_SUCCESS)
+		return -1;
+	VkCommandBufferAllocateInfo cmd_info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = cmd_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	VkCommandBuffer cmd;
+	vkAllocateCommandBuffers(device, &cmd_info, &cmd);
+
+	VkCommandBufferBeginInfo begin_info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	VkClearValue clear_values[4] = {};
+	clear_values[3].depthStencil = { 1.0f, 0 };
+	VkRenderPassBeginInfo pass_info{
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+		.renderPass = render_pass.render_pass,
+		.framebuffer = framebuffer.framebuffer,
+		.renderArea = { .offset = {0, 0}, .extent = extent },
+		.clearValueCount = 4,
+		.pClearValues = clear_values,
+	};
+	vkBeginCommandBuffer(cmd, &begin_info);
+	vkCmdBeginRenderPass(cmd, &pass_info, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdNextSubpass(cmd, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdEndRenderPass(cmd);
+	if (vkEndCommandBuffer(cmd) != VK_SUCCESS)
+		return -1;
+
+	/* the frame fence of the window signals the end of the render pass */
+	VkFence fence = window.begin_frame();
+	VkSubmitInfo submit_info{
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd,
+	};
+	VkResult res = vkQueueSubmit(window.phydev.graphic_queue, 1, &submit_info,
+			fence);
+	if (res == VK_SUCCESS)
+		res = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+	vkDestroyCommandPool(device, cmd_pool, nullptr);
+	return res == VK_SUCCESS ? 0 : -1;
+}
+
+/* fills items[i] = base + i for the first count items */
+static const char *fill_shader = R"___(
+#version 450
+layout(local_size_x = GROUP_X, local_size_y = GROUP_Y) in;
+
+layout(push_constant) uniform Fill {
+	uint count;
+	uint base;
+} fill;
+
+layout(std430, binding = 0) buffer Items {
+	uint items[];
+};
+
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if (i < fill.count)
+		items[i] = fill.base + i;
+}
+)___";
+
+static pge::shader_info_t get_fill_shader(uint32_t group_x,
+		uint32_t group_y = 1)
+{
+	return pge::shader_info_t{
+		.load_type = pge::SHADER_LOAD_SRC,
+		.name = "fill.comp",
+		.code = fill_shader,
+		.defines = {
+			{"GROUP_X", std::to_string(group_x)},
+			{"GROUP_Y", std::to_string(group_y)},
+		},
+	};
+}
+
+/* a buffer fill on the compute queue, checked from the cpu */
+static int test_compute_fill(pge::Window &window) {
+	auto device = window.d->device;
+	auto phy_dev = window.phydev.phy_dev;
+	struct fill_t {
+		uint32_t count;
+		uint32_t base;
+	} fill{ .count = 1000, .base = 7 };
+	const uint32_t item_cnt = 1024;
+
+	/* async_compute takes a compute only family when there is one */
+	uint32_t cnt = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(phy_dev, &cnt, nullptr);
+	std::vector<VkQueueFamilyProperties> families(cnt);
+	vkGetPhysicalDeviceQueueFamilyProperties(phy_dev, &cnt, families.data());
+	bool has_compute_only = std::any_of(families.begin(), families.end(),
+			[](auto &&family) {
+				return (family.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+						!(family.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+			});
+	auto compute_flags = families[window.phydev.compute_index].queueFlags;
+	if (!(compute_flags & VK_QUEUE_COMPUTE_BIT))
+		return -1;
+	if (has_compute_only && (compute_flags & VK_QUEUE_GRAPHICS_BIT))
+		return -1;
+	if (!has_compute_only &&
+			window.phydev.compute_index != window.phydev.graphic_index)
+		return -1;
+	DBG("Compute family: %d, graphic family: %d", window.phydev.compute_index,
+			window.phydev.graphic_index);
+
+	VkDescriptorSetLayoutBinding binding{
+		.binding = 0,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+	};
+	VkDescriptorSetLayoutCreateInfo set_layout_info{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = 1,
+		.pBindings = &binding,
+	};
+	VkDescriptorSetLayout set_layout;
+	if (vkCreateDescriptorSetLayout(device, &set_layout_info, nullptr,
+			&set_layout) != VK_SUCCESS)
+		return -1;
+
+	/* the layout is released when the pipeline can't be made, the same
+	object is then created again. A million invocations compile but no device
+	runs them in one workgroup */
+	pge::ComputePipeline compute(&window);
+	bool failed = false;
+	try {
+		compute.create_pipeline(get_fill_shader(1024, 1024),
+				{ .desc_layout = { set_layout } });
+	}
+	catch (std::exception& e) {
+		DBG("Intentional error: %s", e.what());
+		failed = true;
+	}
+	if (!failed || compute.pipeline_layout || compute.pipeline)
+		return -1;
+
+	compute.create_pipeline(get_fill_shader(64),
+			{ .desc_layout = { set_layout } });
+	if (!compute.pipeline || compute.local_size[0] != 64)
+		return -1;
+	if (compute.push_ranges.size() != 1 ||
+			compute.push_ranges[0].size != sizeof(fill_t))
+		return -1;
+
+	/* host visible, so it is checked without a copy */
+	VkBufferCreateInfo buffer_info{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = item_cnt * sizeof(uint32_t),
+		.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	};
+	VkBuffer buffer;
+	if (vkCreateBuffer(device, &buffer_info, nullptr, &buffer) != VK_SUCCESS)
+		return -1;
+	VkMemoryRequirements mem_reqs;
+	vkGetBufferMemoryRequirements(device, buffer, &mem_reqs);
+	int type = pge::find_memory_type(phy_dev, mem_reqs.memoryTypeBits,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	if (type < 0)
+		return -1;
+	VkMemoryAllocateInfo alloc_info{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = mem_reqs.size,
+		.memoryTypeIndex = (uint32_t)type,
+	};
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(device, &alloc_info, nullptr, &memory) != VK_SUCCESS)
+		return -1;
+	vkBindBufferMemory(device, buffer, memory, 0);
+	uint32_t *items = nullptr;
+	vkMapMemory(device, memory, 0, buffer_info.size, 0, (void **)&items);
+	for (uint32_t i = 0; i < item_cnt; i++)
+		items[i] = 0xffffffff;
+
+	VkDescriptorPoolSize pool_size{
+		.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.descriptorCount = 1,
+	};
+	VkDescriptorPoolCreateInfo desc_pool_info{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = 1,
+		.poolSizeCount = 1,
+		.pPoolSizes = &pool_size,
+	};
+	VkDescriptorPool desc_pool;
+	vkCreateDescriptorPool(device, &desc_pool_info, nullptr, &desc_pool);
+	VkDescriptorSetAllocateInfo set_info{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = desc_pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &set_layout,
+	};
+	VkDescriptorSet set;
+	vkAllocateDescriptorSets(device, &set_info, &set);
+	VkDescriptorBufferInfo desc_buffer{
+		.buffer = buffer,
+		.offset = 0,
+		.range = VK_WHOLE_SIZE,
+	};
+	VkWriteDescriptorSet write{
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = set,
+		.dstBinding = 0,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.pBufferInfo = &desc_buffer,
+	};
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+	VkCommandPoolCreateInfo pool_info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.queueFamilyIndex = window.phydev.compute_index,
+	};
+	VkCommandPool cmd_pool;
+	vkCreateCommandPool(device, &pool_info, nullptr, &cmd_pool);
+	VkCommandBufferAllocateInfo cmd_info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = cmd_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	VkCommandBuffer cmd;
+	vkAllocateCommandBuffers(device, &cmd_info, &cmd);
+
+	VkCommandBufferBeginInfo begin_info{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	VkBufferMemoryBarrier to_host{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+	vkBeginCommandBuffer(cmd, &begin_info);
+	compute.bind(cmd);
+	compute.bind_descriptor_sets(cmd, { set });
+	compute.push_constants(cmd, fill);
+	compute.dispatch_items(cmd, fill.count);
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &to_host, 0, nullptr);
+	vkEndCommandBuffer(cmd);
+
+	VkFenceCreateInfo fence_info{
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+	};
+	VkFence fence;
+	vkCreateFence(device, &fence_info, nullptr, &fence);
+	VkSubmitInfo submit_info{
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd,
+	};
+	VkResult res = vkQueueSubmit(window.phydev.compute_queue, 1, &submit_info,
+			fence);
+	if (res == VK_SUCCESS)
+		res = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+
+	/* the invocations past count wrote nothing */
+	int ret = res == VK_SUCCESS ? 0 : -1;
+	for (uint32_t i = 0; i < item_cnt && ret == 0; i++) {
+		uint32_t expected = i < fill.count ? fill.base + i : 0xffffffff;
+		if (items[i] != expected) {
+			DBG("items[%d] is %x instead of %x", i, items[i], expected);
+			ret = -1;
+		}
+	}
+
+	vkDestroyFence(device, fence, nullptr);
+	vkDestroyCommandPool(device, cmd_pool, nullptr);
+	vkDestroyDescriptorPool(device, desc_pool, nullptr);
+	vkUnmapMemory(device, memory);
+	vkDestroyBuffer(device, buffer, nullptr);
+	vkFreeMemory(device, memory, nullptr);
+	vkDestroyDescriptorSetLayout(device, set_layout, nullptr);
+	return ret;
+}
+
 int main() {
+	// before any instance, mesa would otherwise serve the opt level benchmark
+	// from it's disk cache
+	setenv("MESA_SHADER_CACHE_DISABLE", "true", 1);
+
+/* OFFSCREEN:
+============================================================================= */
+
+	{
+		auto window = make_headless_window(false);
+		if (test_offscreen_deferred(*window) != 0) {
+			DBG("Offscreen deferred render pass failed");
+			return -1;
+		}
+		window->wait_idle();
+	}
+	{
+		auto window = make_headless_window(true);
+		if (test_compute_fill(*window) != 0) {
+			DBG("Compute buffer fill failed");
+			return -1;
+		}
+		window->wait_idle();
+	}
 
 /* GLFW INIT:
 ============================================================================= */
@@ -513,7 +945,8 @@ int main() {
 	DBG("Will load shaders");
 
 	// Obs: not needed after module creation
-	// Obs: slow, should cache and save to disk
+	// Obs: slow on first run, after that loaded from the cache
+	shaderc_lib.shc_set_cache_dir_fn("shader_cache/");
 	size_t vs_code_len = 0;
 	auto vert_code = shaderc_lib.shc_compile_path_fn(
 			"shaders/test_shader.vert", SHC_VERTEX_SHADER, &vs_code_len, true);
@@ -747,12 +1180,88 @@ int main() {
 		.basePipelineIndex = -1, // Optional
 	};
 
+	// Obs: the second run should create the pipeline a lot faster, the driver
+	// finds it inside the saved cache
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+	VkPipelineCache pipelineCache = pge::load_pipeline_cache(device,
+			physicalDeviceProperties, "pipeline_cache.bin");
+
 	VkPipeline graphicsPipeline;
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+	pge::TimePointMs pipeline_time;
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo,
 			nullptr, &graphicsPipeline) != VK_SUCCESS)
 	{
 		EXCEPTION("failed to create graphics pipeline!");
 	}
+	DBG("Pipeline creation: %ld ms", pipeline_time.elapsed());
+
+	// driver side cost of each optimization level. No pipeline cache is used
+	// and mesa's disk cache is off (see main), but a driver may still keep the
+	// compiled shaders in memory, so only the first creation of a level is
+	// reported as a compilation, the next ones as possible cache hits
+	const char *opt_names[] = { "zero", "size", "performance" };
+	for (int level = SHC_OPT_ZERO; level <= SHC_OPT_PERFORMANCE; level++) {
+		shc_opts_t vert_opts{ .kind = SHC_VERTEX_SHADER, .opt_level = level };
+		shc_opts_t frag_opts{ .kind = SHC_FRAGMENT_SHADER, .opt_level = level };
+		std::vector<uint32_t> vert_spv, frag_spv;
+		if (shaderc_lib.compile_path("shaders/test_shader.vert", vert_opts,
+				vert_spv) != SHC_OK ||
+			shaderc_lib.compile_path("shaders/test_shader.frag", frag_opts,
+				frag_spv) != SHC_OK)
+		{
+			EXCEPTION("failed to compile the shaders at level %s",
+					opt_names[level]);
+		}
+
+		VkShaderModuleCreateInfo moduleInfos[] = {
+			{
+				.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+				.codeSize = vert_spv.size() * sizeof(uint32_t),
+				.pCode = vert_spv.data(),
+			},
+			{
+				.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+				.codeSize = frag_spv.size() * sizeof(uint32_t),
+				.pCode = frag_spv.data(),
+			},
+		};
+		VkPipelineShaderStageCreateInfo levelStages[] = {
+			vertShaderStageInfo,
+			fragShaderStageInfo,
+		};
+		for (int i = 0; i < 2; i++)
+			if (vkCreateShaderModule(device, &moduleInfos[i], nullptr,
+					&levelStages[i].module) != VK_SUCCESS)
+			{
+				EXCEPTION("failed to create shader module!");
+			}
+
+		VkGraphicsPipelineCreateInfo levelInfo = pipelineInfo;
+		levelInfo.pStages = levelStages;
+		const int iters = 20;
+		uint64_t first_us = 0;
+		uint64_t rest_us = 0;
+		for (int i = 0; i < iters; i++) {
+			VkPipeline levelPipeline;
+			pge::TimePointUs create_time;
+			if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+					&levelInfo, nullptr, &levelPipeline) != VK_SUCCESS)
+			{
+				EXCEPTION("failed to create graphics pipeline!");
+			}
+			(i ? rest_us : first_us) += create_time.elapsed();
+			vkDestroyPipeline(device, levelPipeline, nullptr);
+		}
+		DBG("opt level %s: %ld bytes of SPIR-V, first creation (compiled): "
+				"%.3f ms, next %d (driver may reuse it): %.3f ms per pipeline",
+				opt_names[level], (moduleInfos[0].codeSize +
+				moduleInfos[1].codeSize), first_us / 1000.0, iters - 1,
+				rest_us / 1000.0 / (iters - 1));
+
+		for (auto &stage : levelStages)
+			vkDestroyShaderModule(device, stage.module, nullptr);
+	}
 
 	// not needed after pipeline creation
 	vkDestroyShaderModule(device, fragShaderModule, nullptr);
@@ -941,6 +1450,8 @@ int main() {
 	    vkDestroyImageView(device, imageView, nullptr);
 	}
 	vkDestroySwapchainKHR(device, swapChain, nullptr);
+	pge::save_pipeline_cache(device, pipelineCache, "pipeline_cache.bin");
+	vkDestroyPipelineCache(device, pipelineCache, nullptr);
 	vkDestroyDevice(device, nullptr);
 	vkDestroySurfaceKHR(instance, surface, nullptr);
 	DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);